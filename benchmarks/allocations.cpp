@@ -0,0 +1,139 @@
+/*!
+@file
+@copyright The code is licensed under the MIT License
+           <http://opensource.org/licenses/MIT>,
+           Copyright (c) 2015 Niels Lohmann.
+@author Niels Lohmann <http://nlohmann.me>
+@see https://github.com/nlohmann/fifo_map
+
+Prints the allocations fifo_map performs per operation for some standard
+workloads. Counts are averaged over all elements of a workload and cover the
+nodes and buckets of the tree and the key index; memory allocated by the keys
+themselves (e.g., std::string copies) is not included.
+*/
+
+#include "fifo_map.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const std::size_t elements = 10000;
+
+template<class Key>
+Key make_key(std::size_t i);
+
+template<>
+int make_key<int>(std::size_t i)
+{
+    return static_cast<int>(i);
+}
+
+template<>
+std::string make_key<std::string>(std::size_t i)
+{
+    // long enough to defeat the small string optimization
+    return "key_with_a_long_common_prefix_" + std::to_string(i);
+}
+
+void report(const char* workload, const char* operation,
+            const nlohmann::fifo_map_allocation_counters& delta, std::size_t operations)
+{
+    const auto per_op = [operations](std::size_t value)
+    {
+        return static_cast<double>(value) / static_cast<double>(operations);
+    };
+
+    std::printf("%-12s %-24s %10.2f %10.2f %12.1f %12.1f\n", workload, operation,
+                per_op(delta.allocations), per_op(delta.deallocations),
+                per_op(delta.bytes_allocated), per_op(delta.bytes_deallocated));
+}
+
+template<class Key>
+void run(const char* workload)
+{
+    using map_type = nlohmann::counting_fifo_map<Key, int>;
+
+    std::vector<Key> keys;
+    for (std::size_t i = 0; i < elements; ++i)
+    {
+        keys.push_back(make_key<Key>(i));
+    }
+
+    map_type m;
+    const auto counters = m.get_allocator().counters();
+    auto before = *counters;
+
+    for (const auto& key : keys)
+    {
+        m.insert({key, 1});
+    }
+    report(workload, "insert (new key)", *counters - before, elements);
+
+    before = *counters;
+    for (const auto& key : keys)
+    {
+        m.insert({key, 2});
+    }
+    report(workload, "insert (existing key)", *counters - before, elements);
+
+    before = *counters;
+    for (const auto& key : keys)
+    {
+        m[key] = 3;
+    }
+    report(workload, "operator[] (existing)", *counters - before, elements);
+
+    before = *counters;
+    for (const auto& key : keys)
+    {
+        m.find(key);
+    }
+    report(workload, "find", *counters - before, elements);
+
+    before = *counters;
+    {
+        map_type copy(m);
+        report(workload, "copy", *counters - before, elements);
+    }
+
+    before = *counters;
+    for (const auto& key : keys)
+    {
+        m.erase(key);
+    }
+    report(workload, "erase (key)", *counters - before, elements);
+
+    before = *counters;
+    for (const auto& key : keys)
+    {
+        m[key] = 4;
+    }
+    report(workload, "operator[] (new key)", *counters - before, elements);
+
+    before = *counters;
+    for (std::size_t i = 0; i < elements; ++i)
+    {
+        m.erase(m.begin());
+        m[make_key<Key>(elements + i)] = 5;
+    }
+    report(workload, "sliding window", *counters - before, elements);
+
+    before = *counters;
+    m.clear();
+    report(workload, "clear", *counters - before, elements);
+}
+
+}
+
+int main()
+{
+    std::printf("%-12s %-24s %10s %10s %12s %12s\n", "workload", "operation",
+                "allocs/op", "frees/op", "bytes/op", "freed/op");
+
+    run<int>("int");
+    run<std::string>("std::string");
+}
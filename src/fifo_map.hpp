@@ -26,13 +26,24 @@ SOFTWARE.
 #define NLOHMANN_FIFO_MAP_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <map>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -43,234 +54,3291 @@ SOFTWARE.
 namespace nlohmann
 {
 
-template<class Key>
-class fifo_map_compare
+/*!
+@brief bump arena for fifo_map allocations
+
+Memory is handed out from large blocks by advancing a pointer. Individual
+deallocations are ignored; all memory is returned at once when the arena is
+released or destroyed. This suits maps that are built once, read, and then
+thrown away as a whole.
+*/
+class fifo_map_arena
 {
   public:
-    /// constructor given a pointer to a key storage
-    fifo_map_compare(
-        std::unordered_map<Key, std::size_t>* keys,
-        std::size_t timestamp = 1)
-        :
-        m_timestamp(timestamp),
-        m_keys(keys)
+    /// constructor given the size of the first block
+    explicit fifo_map_arena(std::size_t block_size = 4096)
+        : m_blocks(), m_current(nullptr), m_remaining(0),
+          m_block_size(block_size), m_reserved(0)
+    {}
+
+    fifo_map_arena(const fifo_map_arena&) = delete;
+    fifo_map_arena& operator=(const fifo_map_arena&) = delete;
+
+    /// returns a pointer to @a bytes bytes aligned to @a alignment
+    void* allocate(std::size_t bytes, std::size_t alignment)
+    {
+        void* result = m_current;
+
+        if (m_current == nullptr || std::align(alignment, bytes, result, m_remaining) == nullptr)
+        {
+            // blocks grow geometrically up to a limit
+            const std::size_t block_size = (std::max)(m_block_size, bytes + alignment);
+            m_block_size = (std::min)(2 * m_block_size, static_cast<std::size_t>(1) << 20);
+
+            m_blocks.emplace_back(new char[block_size]);
+            m_reserved += block_size;
+            m_current = m_blocks.back().get();
+            m_remaining = block_size;
+
+            result = m_current;
+            std::align(alignment, bytes, result, m_remaining);
+        }
+
+        m_current = static_cast<char*>(result) + bytes;
+        m_remaining -= bytes;
+        return result;
+    }
+
+    /// frees all blocks at once
+    void release() noexcept
+    {
+        m_blocks.clear();
+        m_current = nullptr;
+        m_remaining = 0;
+        m_reserved = 0;
+    }
+
+    /// returns the number of bytes obtained from the system
+    std::size_t bytes_reserved() const noexcept
+    {
+        return m_reserved;
+    }
+
+  private:
+    /// the blocks owned by the arena
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    /// the next free byte in the current block
+    char* m_current;
+    /// the number of free bytes in the current block
+    std::size_t m_remaining;
+    /// the size of the next block
+    std::size_t m_block_size;
+    /// the total size of all blocks
+    std::size_t m_reserved;
+};
+
+/*!
+@brief allocator drawing from a fifo_map_arena
+
+A default-constructed allocator creates its own arena, so a map using it owns
+its memory. Pass a shared arena to let several maps allocate from the same
+blocks. Copies and rebound copies share the arena.
+*/
+template<class T>
+class fifo_map_arena_allocator
+{
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    /// default constructor; creates a new arena
+    fifo_map_arena_allocator()
+        : m_arena(std::make_shared<fifo_map_arena>())
+    {}
+
+    /// constructor given a shared arena
+    explicit fifo_map_arena_allocator(std::shared_ptr<fifo_map_arena> arena)
+        : m_arena(std::move(arena))
+    {}
+
+    /// converting constructor for rebinding
+    template<class U>
+    fifo_map_arena_allocator(const fifo_map_arena_allocator<U>& other) noexcept
+        : m_arena(other.arena())
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept
+    {
+        // memory is returned when the arena is released
+    }
+
+    /// returns the arena
+    const std::shared_ptr<fifo_map_arena>& arena() const noexcept
+    {
+        return m_arena;
+    }
+
+  private:
+    /// the arena to allocate from
+    std::shared_ptr<fifo_map_arena> m_arena;
+};
+
+template<class T, class U>
+bool operator==(const fifo_map_arena_allocator<T>& lhs, const fifo_map_arena_allocator<U>& rhs) noexcept
+{
+    return lhs.arena() == rhs.arena();
+}
+
+template<class T, class U>
+bool operator!=(const fifo_map_arena_allocator<T>& lhs, const fifo_map_arena_allocator<U>& rhs) noexcept
+{
+    return lhs.arena() != rhs.arena();
+}
+
+
+/*!
+@brief free-list pool recycling released fifo_map nodes
+
+Deallocated blocks up to 256 bytes are kept on per-size free lists and handed
+out again by later allocations of the same size, so a map which erases and
+inserts at the same rate stops allocating once it reached its steady state.
+At most `retention` blocks are kept per size; further blocks and larger
+requests go straight to the global operator new/delete.
+*/
+class fifo_map_node_pool
+{
+  public:
+    /// constructor given the number of free blocks kept per size
+    explicit fifo_map_node_pool(std::size_t retention = 1024)
+        : m_free(), m_count(), m_retention(retention), m_upstream_allocations(0)
+    {
+        m_free.fill(nullptr);
+        m_count.fill(0);
+    }
+
+    fifo_map_node_pool(const fifo_map_node_pool&) = delete;
+    fifo_map_node_pool& operator=(const fifo_map_node_pool&) = delete;
+
+    ~fifo_map_node_pool()
+    {
+        release();
+    }
+
+    /// returns a block of @a bytes bytes, reusing a free one if possible
+    void* allocate(std::size_t bytes)
+    {
+        if (bytes <= max_pooled_size && bytes > 0)
+        {
+            const std::size_t index = size_class(bytes);
+            if (m_free[index] != nullptr)
+            {
+                free_block* block = m_free[index];
+                m_free[index] = block->next;
+                --m_count[index];
+                return block;
+            }
+
+            bytes = (index + 1) * granularity;
+        }
+
+        ++m_upstream_allocations;
+        return ::operator new(bytes);
+    }
+
+    /// returns a block to the pool or, if the pool is full, to the system
+    void deallocate(void* p, std::size_t bytes) noexcept
+    {
+        if (bytes <= max_pooled_size && bytes > 0)
+        {
+            const std::size_t index = size_class(bytes);
+            if (m_count[index] < m_retention)
+            {
+                free_block* block = static_cast<free_block*>(p);
+                block->next = m_free[index];
+                m_free[index] = block;
+                ++m_count[index];
+                return;
+            }
+        }
+
+        ::operator delete(p);
+    }
+
+    /// returns all free blocks to the system
+    void release() noexcept
+    {
+        for (std::size_t index = 0; index < size_classes; ++index)
+        {
+            while (m_free[index] != nullptr)
+            {
+                free_block* block = m_free[index];
+                m_free[index] = block->next;
+                ::operator delete(block);
+            }
+            m_count[index] = 0;
+        }
+    }
+
+    /// returns the number of free blocks currently kept
+    std::size_t retained() const noexcept
+    {
+        std::size_t result = 0;
+        for (auto count : m_count)
+        {
+            result += count;
+        }
+        return result;
+    }
+
+    /// returns the number of free blocks kept per size
+    std::size_t retention() const noexcept
+    {
+        return m_retention;
+    }
+
+    /// sets the number of free blocks kept per size
+    void set_retention(std::size_t retention) noexcept
+    {
+        m_retention = retention;
+    }
+
+    /// returns the number of allocations not served from a free list
+    std::size_t upstream_allocations() const noexcept
+    {
+        return m_upstream_allocations;
+    }
+
+  private:
+    /// a block on a free list
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    static constexpr std::size_t granularity = 16;
+    static constexpr std::size_t max_pooled_size = 256;
+    static constexpr std::size_t size_classes = max_pooled_size / granularity;
+
+    static std::size_t size_class(std::size_t bytes) noexcept
+    {
+        return (bytes - 1) / granularity;
+    }
+
+    /// the free lists, one per size class
+    std::array<free_block*, size_classes> m_free;
+    /// the number of blocks on each free list
+    std::array<std::size_t, size_classes> m_count;
+    /// the maximal number of blocks per free list
+    std::size_t m_retention;
+    /// the number of allocations passed to operator new
+    std::size_t m_upstream_allocations;
+};
+
+/*!
+@brief allocator recycling nodes through a fifo_map_node_pool
+
+A default-constructed allocator creates its own pool. Copies and rebound
+copies share the pool, so the tree and the key index of a map recycle their
+nodes through the same free lists.
+*/
+template<class T>
+class fifo_map_pool_allocator
+{
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    /// default constructor; creates a new pool
+    fifo_map_pool_allocator()
+        : m_pool(std::make_shared<fifo_map_node_pool>())
+    {}
+
+    /// constructor given a shared pool
+    explicit fifo_map_pool_allocator(std::shared_ptr<fifo_map_node_pool> pool)
+        : m_pool(std::move(pool))
+    {}
+
+    /// converting constructor for rebinding
+    template<class U>
+    fifo_map_pool_allocator(const fifo_map_pool_allocator<U>& other) noexcept
+        : m_pool(other.pool())
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_pool->deallocate(p, n * sizeof(T));
+    }
+
+    /// returns all free nodes of the pool to the system
+    void shrink_to_fit() noexcept
+    {
+        m_pool->release();
+    }
+
+    /// returns the pool
+    const std::shared_ptr<fifo_map_node_pool>& pool() const noexcept
+    {
+        return m_pool;
+    }
+
+  private:
+    /// the pool to allocate from
+    std::shared_ptr<fifo_map_node_pool> m_pool;
+};
+
+template<class T, class U>
+bool operator==(const fifo_map_pool_allocator<T>& lhs, const fifo_map_pool_allocator<U>& rhs) noexcept
+{
+    return lhs.pool() == rhs.pool();
+}
+
+template<class T, class U>
+bool operator!=(const fifo_map_pool_allocator<T>& lhs, const fifo_map_pool_allocator<U>& rhs) noexcept
+{
+    return lhs.pool() != rhs.pool();
+}
+
+
+/// allocation counters filled by fifo_map_counting_allocator
+struct fifo_map_allocation_counters
+{
+    /// the number of calls to allocate()
+    std::size_t allocations = 0;
+    /// the number of calls to deallocate()
+    std::size_t deallocations = 0;
+    /// the number of bytes requested by allocate()
+    std::size_t bytes_allocated = 0;
+    /// the number of bytes returned by deallocate()
+    std::size_t bytes_deallocated = 0;
+
+    /// returns the counters accumulated since @a before was taken
+    fifo_map_allocation_counters operator-(const fifo_map_allocation_counters& before) const noexcept
+    {
+        fifo_map_allocation_counters result;
+        result.allocations = allocations - before.allocations;
+        result.deallocations = deallocations - before.deallocations;
+        result.bytes_allocated = bytes_allocated - before.bytes_allocated;
+        result.bytes_deallocated = bytes_deallocated - before.bytes_deallocated;
+        return result;
+    }
+};
+
+/*!
+@brief allocator counting the allocations of a fifo_map
+
+Forwards to std::allocator and records every call in a shared
+fifo_map_allocation_counters object. Take a copy of the counters before and
+after an operation and subtract them to get the allocations of that
+operation.
+*/
+template<class T>
+class fifo_map_counting_allocator
+{
+  public:
+    using value_type = T;
+
+    /// default constructor; creates new counters
+    fifo_map_counting_allocator()
+        : m_counters(std::make_shared<fifo_map_allocation_counters>())
+    {}
+
+    /// constructor given shared counters
+    explicit fifo_map_counting_allocator(std::shared_ptr<fifo_map_allocation_counters> counters)
+        : m_counters(std::move(counters))
     {}
 
+    /// converting constructor for rebinding
+    template<class U>
+    fifo_map_counting_allocator(const fifo_map_counting_allocator<U>& other) noexcept
+        : m_counters(other.counters())
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        ++m_counters->allocations;
+        m_counters->bytes_allocated += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        ++m_counters->deallocations;
+        m_counters->bytes_deallocated += n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    /// returns the counters
+    const std::shared_ptr<fifo_map_allocation_counters>& counters() const noexcept
+    {
+        return m_counters;
+    }
+
+  private:
+    /// the counters to update
+    std::shared_ptr<fifo_map_allocation_counters> m_counters;
+};
+
+template<class T, class U>
+bool operator==(const fifo_map_counting_allocator<T>&, const fifo_map_counting_allocator<U>&) noexcept
+{
+    // memory is managed by std::allocator and can be freed through any copy
+    return true;
+}
+
+template<class T, class U>
+bool operator!=(const fifo_map_counting_allocator<T>&, const fifo_map_counting_allocator<U>&) noexcept
+{
+    return false;
+}
+
+
+/// how bulk operations treat keys which are already present
+enum class fifo_map_duplicate_policy
+{
+    /// keep the existing value and position
+    first_wins,
+    /// overwrite the value, keep the position
+    last_wins,
+    /// overwrite the value and move the key to the newest position
+    last_wins_moves_to_end
+};
+
+
+/// how a bounded fifo_map picks the element to evict
+enum class fifo_map_eviction_policy
+{
+    /// evict the oldest element
+    fifo,
+    /// give referenced elements a second chance (CLOCK)
+    clock
+};
+
+/// whether a full bounded fifo_map accepts a new key
+enum class fifo_map_admission_policy
+{
+    /// always insert the new key and evict
+    always,
+    /// insert only keys estimated to be used more often than the victim
+    tinylfu
+};
+
+/*!
+@brief count-min sketch estimating how often keys were used
+
+Each key hash selects one counter in each of four rows; the estimate is the
+smallest of these counters, which overestimates only on hash collisions.
+Counters saturate at 15. After ten times as many increments as there are
+counters in a row, all counters are halved, so old popularity fades out.
+*/
+class fifo_map_frequency_sketch
+{
+  public:
+    /// creates an empty sketch which counts nothing
+    fifo_map_frequency_sketch() = default;
+
+    /// creates a sketch sized for about @a capacity distinct keys
+    explicit fifo_map_frequency_sketch(std::size_t capacity)
+    {
+        resize(capacity);
+    }
+
+    /// resizes the sketch for about @a capacity distinct keys and resets it
+    void resize(std::size_t capacity)
+    {
+        std::size_t width = 16;
+        while (width < capacity)
+        {
+            width <<= 1;
+        }
+
+        m_counters.assign(width * depth, 0);
+        m_mask = width - 1;
+        m_sample_size = 10 * width;
+        m_additions = 0;
+    }
+
+    /// returns the number of counters per row; 0 for an empty sketch
+    std::size_t width() const noexcept
+    {
+        return m_counters.size() / depth;
+    }
+
+    /// returns the number of bytes allocated for the counters
+    std::size_t bytes() const noexcept
+    {
+        return m_counters.capacity();
+    }
+
+    /// counts a use of the key with hash value @a hash
+    void increment(std::size_t hash)
+    {
+        if (m_counters.empty())
+        {
+            return;
+        }
+
+        bool added = false;
+        for (std::size_t row = 0; row < depth; ++row)
+        {
+            auto& counter = m_counters[index(hash, row)];
+            if (counter < max_count)
+            {
+                ++counter;
+                added = true;
+            }
+        }
+
+        if (added && ++m_additions >= m_sample_size)
+        {
+            age();
+        }
+    }
+
+    /// returns the estimated number of uses of the key with hash value @a hash
+    std::uint8_t estimate(std::size_t hash) const noexcept
+    {
+        if (m_counters.empty())
+        {
+            return 0;
+        }
+
+        std::uint8_t result = max_count;
+        for (std::size_t row = 0; row < depth; ++row)
+        {
+            const auto counter = m_counters[index(hash, row)];
+            if (counter < result)
+            {
+                result = counter;
+            }
+        }
+        return result;
+    }
+
+    /// resets all counters
+    void clear() noexcept
+    {
+        std::fill(m_counters.begin(), m_counters.end(), std::uint8_t(0));
+        m_additions = 0;
+    }
+
+  private:
+    /// halves all counters
+    void age() noexcept
+    {
+        for (auto& counter : m_counters)
+        {
+            counter = static_cast<std::uint8_t>(counter >> 1);
+        }
+        m_additions /= 2;
+    }
+
+    /// returns the position of the counter of @a hash in row @a row
+    std::size_t index(std::size_t hash, std::size_t row) const noexcept
+    {
+        // derive an independent hash per row (splitmix64 finalizer)
+        std::uint64_t h = static_cast<std::uint64_t>(hash) + (row + 1) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        return row * (m_mask + 1) + (static_cast<std::size_t>(h) & m_mask);
+    }
+
+    /// the number of rows
+    static constexpr std::size_t depth = 4;
+    /// the maximal counter value
+    static constexpr std::uint8_t max_count = 15;
+
+    /// the counters, row by row
+    std::vector<std::uint8_t> m_counters {};
+    /// the number of counters per row minus one
+    std::size_t m_mask = 0;
+    /// the number of increments after which the counters are halved
+    std::size_t m_sample_size = 0;
+    /// the number of increments since the last halving
+    std::size_t m_additions = 0;
+};
+
+
+/*!
+@brief operation counters of a fifo_map
+
+Collected by fifo_map once enabled with enable_stats(). Lookups are calls to
+find(), at(), and operator[], also through a const map; an operator[] miss
+also counts as insertion.
+*/
+struct fifo_map_stats
+{
+    /// the number of lookups
+    std::size_t lookups = 0;
+    /// the number of lookups finding their key
+    std::size_t hits = 0;
+    /// the number of lookups not finding their key
+    std::size_t misses = 0;
+    /// the number of inserted elements
+    std::size_t inserts = 0;
+    /// the number of values assigned to existing elements
+    std::size_t overwrites = 0;
+    /// the number of elements evicted for the capacity or weight bound
+    std::size_t evictions = 0;
+    /// the number of elements removed because their time to live passed
+    std::size_t expirations = 0;
+    /// the number of new keys refused by the admission policy
+    std::size_t rejections = 0;
+
+    /// returns the fraction of lookups that were hits; 0 without lookups
+    double hit_ratio() const noexcept
+    {
+        return lookups == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(lookups);
+    }
+};
+
+/*!
+@brief the counters behind fifo_map_stats
+
+The counters are relaxed atomics, so lookups through a const map can be
+counted from several threads at once. A snapshot reads each counter on its
+own and is not consistent across counters while they are updated.
+*/
+struct fifo_map_stats_counters
+{
+    fifo_map_stats_counters() = default;
+
+    /// copy constructor
+    fifo_map_stats_counters(const fifo_map_stats_counters& other) noexcept
+    {
+        *this = other;
+    }
+
+    /// copy assignment
+    fifo_map_stats_counters& operator=(const fifo_map_stats_counters& other) noexcept
+    {
+        const auto values = other.snapshot();
+        lookups.store(values.lookups, std::memory_order_relaxed);
+        hits.store(values.hits, std::memory_order_relaxed);
+        misses.store(values.misses, std::memory_order_relaxed);
+        inserts.store(values.inserts, std::memory_order_relaxed);
+        overwrites.store(values.overwrites, std::memory_order_relaxed);
+        evictions.store(values.evictions, std::memory_order_relaxed);
+        expirations.store(values.expirations, std::memory_order_relaxed);
+        rejections.store(values.rejections, std::memory_order_relaxed);
+        return *this;
+    }
+
+    /// returns the current values
+    fifo_map_stats snapshot() const noexcept
+    {
+        fifo_map_stats result;
+        result.lookups = lookups.load(std::memory_order_relaxed);
+        result.hits = hits.load(std::memory_order_relaxed);
+        result.misses = misses.load(std::memory_order_relaxed);
+        result.inserts = inserts.load(std::memory_order_relaxed);
+        result.overwrites = overwrites.load(std::memory_order_relaxed);
+        result.evictions = evictions.load(std::memory_order_relaxed);
+        result.expirations = expirations.load(std::memory_order_relaxed);
+        result.rejections = rejections.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    /// sets all counters to 0
+    void reset() noexcept
+    {
+        *this = fifo_map_stats_counters();
+    }
+
+    /// adds one to @a counter
+    static void increment(std::atomic<std::size_t>& counter) noexcept
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// the counters, named as in fifo_map_stats
+    std::atomic<std::size_t> lookups {0};
+    std::atomic<std::size_t> hits {0};
+    std::atomic<std::size_t> misses {0};
+    std::atomic<std::size_t> inserts {0};
+    std::atomic<std::size_t> overwrites {0};
+    std::atomic<std::size_t> evictions {0};
+    std::atomic<std::size_t> expirations {0};
+    std::atomic<std::size_t> rejections {0};
+};
+
+/*!
+@brief estimated heap memory of a fifo_map in bytes
+
+Node sizes are modeled after the standard library in use (libstdc++, libc++,
+or else the MSVC layout) and rounded to heap blocks of a general purpose
+allocator with 16-byte granularity and one word of header.
+Memory owned by the keys and values themselves (e.g., the characters of a
+long std::string) and the fifo_map object itself are not included.
+*/
+struct fifo_map_memory_usage
+{
+    /// the keys and values stored in the tree nodes
+    std::size_t entries = 0;
+    /// the links, padding and heap headers of the tree nodes
+    std::size_t order = 0;
+    /// the nodes of the key index, each holding a key copy and a timestamp
+    std::size_t key_index = 0;
+    /// the bucket array of the key index needed for the current size
+    std::size_t buckets = 0;
+    /// the used part of the cache state (element table, sketch, reclaim list)
+    std::size_t cache = 0;
+    /// buckets beyond the load factor and unused vector capacity
+    std::size_t slack = 0;
+
+    /// returns the sum of all parts
+    std::size_t total() const noexcept
+    {
+        return entries + order + key_index + buckets + cache + slack;
+    }
+};
+
+
+template <
+    class Key,
+    class KeyAllocator = std::allocator<std::pair<const Key, std::size_t>>
+    >
+class fifo_map_compare
+{
+  public:
+    /// the mapping from keys to insertion timestamps
+    using key_storage_type = std::unordered_map<Key, std::size_t, std::hash<Key>, std::equal_to<Key>, KeyAllocator>;
+
+    /// constructor given a pointer to a key storage
+    fifo_map_compare(
+        key_storage_type* keys,
+        std::size_t timestamp = 1)
+        :
+        m_timestamp(timestamp),
+        m_keys(keys)
+    {}
+
+    /// copy constructor
+    fifo_map_compare(const fifo_map_compare&) = default;
+
+    /*!
+    @brief copy assignment; keeps the key storage
+
+    Only the timestamp is copied, so a comparator stays bound to the key
+    storage of the map owning it. Swapping two trees swaps their comparators,
+    and each tree must go on consulting the key storage of its own map.
+    */
+    fifo_map_compare& operator=(const fifo_map_compare& other) noexcept
+    {
+        m_timestamp = other.m_timestamp;
+        return *this;
+    }
+
+    /*!
+    This function compares two keys with respect to the order in which they
+    were added to the container. For this, the mapping keys is used.
+    */
+    bool operator()(const Key& lhs, const Key& rhs) const
+    {
+        // look up timestamps for both keys
+        const auto timestamp_lhs = m_keys->find(lhs);
+        const auto timestamp_rhs = m_keys->find(rhs);
+
+        if (timestamp_lhs == m_keys->end())
+        {
+            // timestamp for lhs not found - cannot be smaller than for rhs
+            return false;
+        }
+
+        if (timestamp_rhs == m_keys->end())
+        {
+            // timestamp for rhs not found - timestamp for lhs is smaller
+            return true;
+        }
+
+        // compare timestamps
+        return timestamp_lhs->second < timestamp_rhs->second;
+    }
+
+    void add_key(const Key& key)
+    {
+        m_keys->insert({key, m_timestamp++});
+    }
+
+    void remove_key(const Key& key)
+    {
+        m_keys->erase(key);
+    }
+
+  private:
+    /// helper to access m_timestamp from fifo_map copy ctor,
+    /// must have same number of template args as fifo_map
+    template <
+        class MapKey,
+        class MapT,
+        class MapCompare,
+        class MapAllocator
+        > friend class fifo_map;
+
+  private:
+    /// the next valid insertion timestamp
+    std::size_t m_timestamp = 1;
+
+    /// pointer to a mapping from keys to insertion timestamps
+    key_storage_type* m_keys = nullptr;
+};
+
+
+template <
+    class Key,
+    class T,
+    class Compare = fifo_map_compare<Key>,
+    class Allocator = std::allocator<std::pair<const Key, T>>
+    > class fifo_map
+{
+  public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using pointer = typename std::allocator_traits<Allocator>::pointer;
+    using const_pointer = typename std::allocator_traits<Allocator>::const_pointer;
+
+    using internal_map_type = std::map<Key, T, Compare, Allocator>;
+    using eviction_callback = std::function<void(const Key&, T&&)>;
+    using weigher_type = std::function<std::size_t(const Key&, const T&)>;
+    using clock_type = std::chrono::steady_clock;
+    using time_point = clock_type::time_point;
+    using duration = clock_type::duration;
+    using key_storage_type = typename Compare::key_storage_type;
+    using key_allocator_type = typename key_storage_type::allocator_type;
+
+    using iterator = typename internal_map_type::iterator;
+    using const_iterator = typename internal_map_type::const_iterator;
+    using reverse_iterator = typename internal_map_type::reverse_iterator;
+    using const_reverse_iterator = typename internal_map_type::const_reverse_iterator;
+
+  public:
+    /// default constructor
+    fifo_map() : fifo_map(Allocator()) {}
+
+    /*!
+    @brief constructor given an allocator
+
+    The allocator is also used for the key index if it converts to the
+    allocator of Compare::key_storage_type; otherwise the key index uses a
+    default-constructed one, e.g., std::allocator for fifo_map_compare<Key>.
+    */
+    explicit fifo_map(const Allocator& alloc)
+        : m_keys(make_key_allocator(alloc, 0)), m_compare(&m_keys), m_map(m_compare, alloc), m_cache() {}
+
+    /// copy constructor
+    fifo_map(const fifo_map &f)
+        : m_keys(f.m_keys), m_compare(&m_keys, f.m_compare.m_timestamp),
+          m_map(f.m_map.begin(), f.m_map.end(), m_compare,
+                std::allocator_traits<Allocator>::select_on_container_copy_construction(f.m_map.get_allocator())),
+          m_cache(f.m_cache ? new cache_state(*f.m_cache) : nullptr)
+    {
+        // the hand points into the other map
+        if (m_cache)
+        {
+            m_cache->hand_set = false;
+        }
+    }
+
+    /// constructor for a range of elements
+    template<class InputIterator>
+    fifo_map(InputIterator first, InputIterator last)
+        : fifo_map()
+    {
+        insert(first, last);
+    }
+
+    /// constructor for a list of elements
+    fifo_map(std::initializer_list<value_type> init) : fifo_map()
+    {
+        insert(init);
+    }
+
+    /// copy assignment
+    fifo_map& operator=(const fifo_map& other)
+    {
+        if (this != &other)
+        {
+            // the trees' comparators must keep pointing to their own key index
+            m_map.clear();
+            m_keys = other.m_keys;
+            m_compare.m_timestamp = other.m_compare.m_timestamp;
+            m_map.insert(other.m_map.begin(), other.m_map.end());
+            m_cache.reset(other.m_cache ? new cache_state(*other.m_cache) : nullptr);
+            if (m_cache)
+            {
+                m_cache->hand_set = false;
+            }
+        }
+
+        return *this;
+    }
+
+
+    /// returns the allocator associated with the container
+    allocator_type get_allocator() const
+    {
+        return m_map.get_allocator();
+    }
+
+
+    /*
+     * Element access
+     */
+
+    /// access specified element with bounds checking
+    T& at(const Key& key)
+    {
+        const auto it = find(key);
+        if (it == m_map.end())
+        {
+            throw std::out_of_range("key not found");
+        }
+        return it->second;
+    }
+
+    /// access specified element with bounds checking
+    const T& at(const Key& key) const
+    {
+        const auto it = find(key);
+        if (it == m_map.end())
+        {
+            throw std::out_of_range("key not found");
+        }
+        return it->second;
+    }
+
+    /// access specified element
+    T& operator[](const Key& key)
+    {
+        const auto added = add_key(key);
+        if (!added.second && expired(added.first->second))
+        {
+            // the key may belong to the element about to be removed
+            Key fresh(key);
+            remove_expired(added.first);
+            return (*this)[std::move(fresh)];
+        }
+
+        record_lookup(key, !added.second);
+        if (!added.second)
+        {
+            mark_referenced(added.first->second);
+            return m_map.find(key)->second;
+        }
+
+        return append(added.first, std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>())->second;
+    }
+
+    /// access specified element
+    T& operator[](Key&& key)
+    {
+        const auto added = add_key(key);
+        if (!added.second && expired(added.first->second))
+        {
+            remove_expired(added.first);
+            return (*this)[std::move(key)];
+        }
+
+        record_lookup(key, !added.second);
+        if (!added.second)
+        {
+            mark_referenced(added.first->second);
+            return m_map.find(key)->second;
+        }
+
+        return append(added.first, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::tuple<>())->second;
+    }
+
+    /// access the oldest element; the map must not be empty
+    reference front()
+    {
+        return *m_map.begin();
+    }
+
+    /// access the oldest element; the map must not be empty
+    const_reference front() const
+    {
+        return *m_map.begin();
+    }
+
+    /// access the newest element; the map must not be empty
+    reference back()
+    {
+        return *m_map.rbegin();
+    }
+
+    /// access the newest element; the map must not be empty
+    const_reference back() const
+    {
+        return *m_map.rbegin();
+    }
+
+
+    /*
+     * Iterators
+     */
+
+    /// returns an iterator to the beginning
+    iterator begin() noexcept
+    {
+        return m_map.begin();
+    }
+
+    /// returns an iterator to the end
+    iterator end() noexcept
+    {
+        return m_map.end();
+    }
+
+    /// returns an iterator to the beginning
+    const_iterator begin() const noexcept
+    {
+        return m_map.begin();
+    }
+
+    /// returns an iterator to the end
+    const_iterator end() const noexcept
+    {
+        return m_map.end();
+    }
+
+    /// returns an iterator to the beginning
+    const_iterator cbegin() const noexcept
+    {
+        return m_map.cbegin();
+    }
+
+    /// returns an iterator to the end
+    const_iterator cend() const noexcept
+    {
+        return m_map.cend();
+    }
+
+    /// returns a reverse iterator to the beginning
+    reverse_iterator rbegin() noexcept
+    {
+        return m_map.rbegin();
+    }
+
+    /// returns a reverse iterator to the end
+    reverse_iterator rend() noexcept
+    {
+        return m_map.rend();
+    }
+
+    /// returns a reverse iterator to the beginning
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return m_map.rbegin();
+    }
+
+    /// returns a reverse iterator to the end
+    const_reverse_iterator rend() const noexcept
+    {
+        return m_map.rend();
+    }
+
+    /// returns a reverse iterator to the beginning
+    const_reverse_iterator crbegin() const noexcept
+    {
+        return m_map.crbegin();
+    }
+
+    /// returns a reverse iterator to the end
+    const_reverse_iterator crend() const noexcept
+    {
+        return m_map.crend();
+    }
+
+
+    /*
+     * Capacity
+     */
+
+    /// checks whether the container is empty
+    bool empty() const noexcept
+    {
+        return m_map.empty();
+    }
+
+    /// returns the number of elements
+    size_type size() const noexcept
+    {
+        return m_map.size();
+    }
+
+    /// returns the maximum possible number of elements
+    size_type max_size() const noexcept
+    {
+        return m_map.max_size();
+    }
+
+    /*!
+    @brief estimates the heap memory used by the map
+
+    Computed in constant time from the sizes of the internal structures; see
+    fifo_map_memory_usage for what is covered. Blocks kept for reuse by a
+    pooling allocator are not included.
+    */
+    fifo_map_memory_usage memory_usage() const noexcept
+    {
+        using key_record = typename key_storage_type::value_type;
+        const std::size_t word = sizeof(void*);
+
+        fifo_map_memory_usage result;
+        result.entries = m_map.size() * sizeof(value_type);
+        // color, parent, left and right precede the value
+        result.order = m_map.size() * (heap_block(4 * word + sizeof(value_type)) - sizeof(value_type));
+
+        using element_record = typename element_table::value_type;
+
+#if defined(_LIBCPP_VERSION)
+        // next pointer and hash code precede the value; one pointer per bucket
+        const std::size_t key_node = 2 * word + sizeof(key_record);
+        const std::size_t element_node = 2 * word + sizeof(element_record);
+        const std::size_t bucket = word;
+        const size_type inline_buckets = 0;
+#elif defined(__GLIBCXX__)
+        // next pointer, value, and the hash code cached for non-scalar keys;
+        // a single bucket is stored inside the key index itself
+        const std::size_t key_node = word + sizeof(key_record) + (std::is_scalar<Key>::value ? 0 : sizeof(std::size_t));
+        const std::size_t element_node = word + sizeof(element_record);
+        const std::size_t bucket = word;
+        const size_type inline_buckets = 1;
+#else
+        // a node of a doubly linked list; each bucket holds two list iterators
+        const std::size_t key_node = 2 * word + sizeof(key_record);
+        const std::size_t element_node = 2 * word + sizeof(element_record);
+        const std::size_t bucket = 2 * word;
+        const size_type inline_buckets = 0;
+#endif
+        result.key_index = m_keys.size() * heap_block(key_node);
+
+        if (m_keys.bucket_count() > inline_buckets)
+        {
+            const auto needed = std::min(m_keys.bucket_count(),
+                                         static_cast<size_type>(static_cast<float>(m_keys.size()) / m_keys.max_load_factor()) + 1);
+            result.buckets = needed * bucket;
+            result.slack = heap_block(m_keys.bucket_count() * bucket) - result.buckets;
+        }
+
+        if (m_cache)
+        {
+            const auto& elements = m_cache->elements;
+            const auto& pending = m_cache->reclaim_list;
+            result.cache = heap_block(sizeof(cache_state)) + m_cache->sketch.bytes() + pending.size() * sizeof(T);
+            result.slack += (pending.capacity() - pending.size()) * sizeof(T);
+            if (m_cache->tracking)
+            {
+                result.cache += elements.size() * heap_block(element_node) + elements.bucket_count() * bucket;
+            }
+        }
+
+        return result;
+    }
+
+    /// returns the maximal number of elements kept; 0 means unbounded
+    size_type capacity() const noexcept
+    {
+        return m_cache ? m_cache->capacity : 0;
+    }
+
+    /// returns the policy choosing the element to evict
+    fifo_map_eviction_policy eviction_policy() const noexcept
+    {
+        return m_cache ? m_cache->policy : fifo_map_eviction_policy::fifo;
+    }
+
+    /*!
+    @brief sets the policy choosing the element to evict
+
+    With fifo_map_eviction_policy::clock, find(), at(), and operator[] on an
+    existing key set a reference bit instead of reordering the map. The bit
+    is an atomic flag in the element table, apart from the timestamps the
+    order is based on, so lookups through a const map count as hits as well
+    and may run concurrently. When the capacity bound needs a victim, a hand
+    walks the elements in insertion order, starting where it stopped last
+    time: a referenced element loses its bit and is passed, and the first
+    unreferenced one is evicted. Elements added since the hand last wrapped
+    around count as behind the hand, so the hand wraps around when it reaches
+    them or the end, and new elements are inspected last, as in a classic
+    CLOCK. No element is relinked, so references and iterators to the
+    survivors stay valid, and their order and deadlines do not change.
+    */
+    void set_eviction_policy(fifo_map_eviction_policy policy)
+    {
+        auto& state = cache();
+        state.policy = policy;
+        state.hand_set = false;
+        update_tracking();
+    }
+
+    /*!
+    @brief sets a function receiving every evicted element
+
+    The function is called with the key and the moved value of each element
+    removed by the capacity bound, pop_front(), or pop_back(), right before the
+    element is destroyed. It must not modify the map. Elements removed by
+    erase() or clear() are not passed. An empty function removes the callback.
+    */
+    void set_eviction_callback(eviction_callback callback)
+    {
+        cache().on_evict = std::move(callback);
+    }
+
+    /// returns whether evicted values are kept until reclaim()
+    bool deferred_reclaim() const noexcept
+    {
+        return m_cache && m_cache->defer_reclaim;
+    }
+
+    /*!
+    @brief defers the destruction of evicted values
+
+    When enabled and no eviction callback is set, the values of elements
+    removed by the capacity or weight bound, expiry, pop_front(), or
+    pop_back() are moved to a reclaim list instead of being destroyed, so
+    the operation triggering the eviction does not pay for freeing large
+    values. The list is drained by reclaim(), or handed over with
+    take_reclaim_list() to be destroyed elsewhere, e.g., on another thread.
+    Disabling destroys all pending values.
+    */
+    void set_deferred_reclaim(bool enabled)
+    {
+        auto& state = cache();
+        state.defer_reclaim = enabled;
+        if (!enabled)
+        {
+            state.reclaim_list.clear();
+        }
+    }
+
+    /// returns the number of evicted values awaiting destruction
+    size_type pending_reclaim() const noexcept
+    {
+        return m_cache ? m_cache->reclaim_list.size() : 0;
+    }
+
+    /*!
+    @brief destroys up to @a budget evicted values
+
+    The storage of the reclaim list is kept for further evictions.
+
+    @return the number of destroyed values
+    */
+    size_type reclaim(size_type budget = std::numeric_limits<size_type>::max())
+    {
+        if (!m_cache)
+        {
+            return 0;
+        }
+
+        auto& pending = m_cache->reclaim_list;
+        const size_type count = std::min(budget, pending.size());
+        pending.erase(pending.end() - static_cast<std::ptrdiff_t>(count), pending.end());
+        return count;
+    }
+
+    /// removes and returns all evicted values awaiting destruction
+    std::vector<T> take_reclaim_list()
+    {
+        std::vector<T> result;
+        if (m_cache)
+        {
+            result.swap(m_cache->reclaim_list);
+        }
+        return result;
+    }
+
+    /// returns the time to live of new elements; zero means no expiry
+    duration ttl() const noexcept
+    {
+        return m_cache ? m_cache->ttl : duration::zero();
+    }
+
+    /*!
+    @brief lets elements expire a fixed time after their insertion
+
+    Every element gets the deadline now + @a ttl when it is inserted or moved
+    to the back; elements already in the map get it right away. With a uniform
+    time to live, insertion order is expiry order, so expired elements are
+    always at the front: each insertion removes up to two of them, and
+    expire() removes all. The deadline is kept in the element table, one
+    entry per element, which exists only while expiry, a weigher, or the
+    CLOCK policy needs it. Lookups (find(), at(), count(), operator[]) treat
+    an expired element as missing; through a non-const map they remove it
+    and up to two expired elements from the front. Iteration and the other
+    modifiers see expired elements until they are removed. A @a ttl of zero
+    disables expiry.
+    */
+    void set_ttl(duration ttl)
+    {
+        auto& state = cache();
+        state.ttl = ttl;
+        update_tracking();
+
+        if (ttl > duration::zero())
+        {
+            const auto deadline = now() + ttl;
+            for (auto& entry : state.elements)
+            {
+                entry.second.deadline = deadline;
+            }
+        }
+    }
+
+    /// sets the clock used for deadlines; an empty function restores steady_clock
+    void set_clock(std::function<time_point()> clock)
+    {
+        cache().clock = std::move(clock);
+    }
+
+    /*!
+    @brief removes all elements whose deadline is not after @a now
+
+    Expired elements are passed to the eviction callback.
+
+    @return the number of removed elements
+    */
+    size_type expire(time_point now)
+    {
+        return expire(now, m_map.size());
+    }
+
+    /// removes all elements whose deadline has passed
+    size_type expire()
+    {
+        return expire(now());
+    }
+
+    /// returns the policy deciding whether a full map accepts a new key
+    fifo_map_admission_policy admission_policy() const noexcept
+    {
+        return m_cache ? m_cache->admission : fifo_map_admission_policy::always;
+    }
+
+    /*!
+    @brief sets the policy deciding whether a full map accepts a new key
+
+    With fifo_map_admission_policy::tinylfu, lookups (find(), at(),
+    operator[]) and insertion attempts are counted in a count-min sketch
+    sized for the capacity. Lookups through a const map are not counted, so
+    they stay free of writes. Once the map is full, insert(), emplace(),
+    insert_or_assign(), and the range insertions only accept a new key if it
+    is estimated to be used more often than the oldest element; otherwise
+    the key is dropped and end() is returned. A key seen only once thus
+    never displaces an element, which keeps one-off scans from flushing the
+    map. operator[] always inserts. Setting the policy resets the sketch.
+    */
+    void set_admission_policy(fifo_map_admission_policy policy)
+    {
+        auto& state = cache();
+        state.admission = policy;
+        if (policy == fifo_map_admission_policy::tinylfu)
+        {
+            state.sketch.resize(state.capacity);
+        }
+        else
+        {
+            state.sketch = fifo_map_frequency_sketch();
+        }
+    }
+
+    /// returns whether operation counters are collected
+    bool stats_enabled() const noexcept
+    {
+        return m_cache && m_cache->record_stats;
+    }
+
+    /*!
+    @brief starts or stops collecting operation counters
+
+    Counters are kept while collection is stopped. Without collection, each
+    counted operation only checks a flag.
+    */
+    void enable_stats(bool enabled = true)
+    {
+        cache().record_stats = enabled;
+    }
+
+    /// returns a snapshot of the operation counters
+    fifo_map_stats stats() const noexcept
+    {
+        return m_cache ? m_cache->stats.snapshot() : fifo_map_stats();
+    }
+
+    /// resets all operation counters to 0
+    void reset_stats() noexcept
+    {
+        if (m_cache)
+        {
+            m_cache->stats.reset();
+        }
+    }
+
+    /// returns the total weight of all elements; 0 without a weigher
+    std::size_t total_weight() const noexcept
+    {
+        return m_cache ? m_cache->total_weight : 0;
+    }
+
+    /// returns the weight budget; 0 means unbounded
+    std::size_t max_weight() const noexcept
+    {
+        return m_cache ? m_cache->max_weight : 0;
+    }
+
+    /*!
+    @brief sets the function measuring the weight of an element
+
+    The weigher is called when an element is inserted or assigned through
+    insert_or_assign(). The measured weight is stored in the element table
+    and subtracted again when the element is removed, so the total weight stays
+    consistent even if a value changes in place. Such changes are not
+    measured, though: values whose weight changes should be assigned with
+    insert_or_assign() rather than through operator[] or iterators. Note
+    that operator[] measures the default-constructed value of a new key.
+    Setting a weigher measures all present elements; an empty function
+    disables weight tracking.
+    */
+    void set_weigher(weigher_type weigher)
+    {
+        auto& state = cache();
+        state.weigher = std::move(weigher);
+        state.total_weight = 0;
+        update_tracking();
+
+        if (state.tracking)
+        {
+            for (const auto& entry : m_map)
+            {
+                auto& element = element_of(m_keys.find(entry.first)->second);
+                element.weight = 0;
+                add_weight(element, entry);
+            }
+        }
+
+        enforce_capacity(m_map.end());
+    }
+
+    /*!
+    @brief bounds the total weight of the elements
+
+    While the total weight exceeds @a budget, elements are evicted like for
+    the capacity bound. The newest element is never evicted for its weight,
+    so an element heavier than the budget stays until the next insertion. A
+    budget of 0 removes the bound. Requires a weigher.
+    */
+    void set_max_weight(std::size_t budget)
+    {
+        cache().max_weight = budget;
+        enforce_capacity(m_map.end());
+    }
+
+    /*!
+    @brief bounds the number of elements
+
+    Once the map holds @a max_entries elements, inserting a new key evicts the
+    oldest element. Shrinking the capacity evicts immediately. A capacity of 0
+    removes the bound.
+    */
+    void set_capacity(size_type max_entries)
+    {
+        auto& state = cache();
+        state.capacity = max_entries;
+        if (state.admission == fifo_map_admission_policy::tinylfu)
+        {
+            state.sketch.resize(max_entries);
+        }
+        enforce_capacity(m_map.end());
+    }
+
+
+    /*
+     * Modifiers
+     */
+
+    /*!
+    @brief clears the contents
+
+    The bucket array of the key index is kept, so refilling the map to its
+    previous size does not rehash. With a pooling allocator, the released
+    nodes are kept for reuse as well. Use clear_and_release() to return this
+    memory.
+    */
+    void clear() noexcept
+    {
+        m_map.clear();
+        m_keys.clear();
+
+        if (m_cache)
+        {
+            m_cache->elements.clear();
+            m_cache->total_weight = 0;
+            m_cache->hand_set = false;
+        }
+    }
+
+    /// clears the contents and releases all memory kept for reuse
+    void clear_and_release()
+    {
+        clear();
+        key_storage_type(m_keys.get_allocator()).swap(m_keys);
+        shrink_to_fit();
+    }
+
+    /// insert value
+    std::pair<iterator, bool> insert(const value_type& value)
+    {
+        return insert_back(value);
+    }
+
+    /// insert value
+    template<class P>
+    std::pair<iterator, bool> insert( P&& value )
+    {
+        return insert_back(std::forward<P>(value));
+    }
+
+    /// insert value with hint; new keys are always appended
+    iterator insert(const_iterator, const value_type& value)
+    {
+        return insert_back(value).first;
+    }
+
+    /// insert value with hint; new keys are always appended
+    iterator insert(const_iterator, value_type&& value)
+    {
+        return insert_back(std::move(value)).first;
+    }
+
+    /// insert value range
+    template<class InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        reserve_range(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+
+        for (auto it = first; it != last; ++it)
+        {
+            insert_back(*it);
+        }
+    }
+
+    /// insert value list
+    void insert(std::initializer_list<value_type> ilist)
+    {
+        insert(ilist.begin(), ilist.end());
+    }
+
+    /// constructs element in-place
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args&& ... args)
+    {
+        return insert_back(value_type(std::forward<Args>(args)...));
+    }
+
+    /// constructs element in-place with hint; new keys are always appended
+    template<class... Args>
+    iterator emplace_hint(const_iterator, Args&& ... args)
+    {
+        return insert_back(value_type(std::forward<Args>(args)...)).first;
+    }
+
+    /*!
+    @brief inserts a value or assigns it to an existing key
+
+    An existing element keeps its position. With a weigher, the element is
+    measured again, which may evict older elements.
+    */
+    template<class M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj)
+    {
+        const auto added = add_key(key);
+        if (added.second)
+        {
+            if (!admit(key))
+            {
+                m_keys.erase(added.first);
+                return {m_map.end(), false};
+            }
+
+            return {append(added.first, key, std::forward<M>(obj)), true};
+        }
+
+        return {assign(m_map.find(key), std::forward<M>(obj)), false};
+    }
+
+    /// inserts a value or assigns it to an existing key
+    template<class M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj)
+    {
+        const auto added = add_key(key);
+        if (added.second)
+        {
+            if (!admit(key))
+            {
+                m_keys.erase(added.first);
+                return {m_map.end(), false};
+            }
+
+            return {append(added.first, std::move(key), std::forward<M>(obj)), true};
+        }
+
+        return {assign(m_map.find(key), std::forward<M>(obj)), false};
+    }
+
+    /*!
+    @brief inserts a range, resolving existing keys by a policy
+
+    Unlike insert(first, last), which always keeps existing values, keys that
+    are already present or occur more than once are handled according to
+    @a policy. The key index is reserved once for forward iterators, and each
+    element is looked up once in the key index.
+
+    @return the number of keys that were new
+    */
+    template<class InputIt>
+    size_type insert_range(InputIt first, InputIt last, fifo_map_duplicate_policy policy)
+    {
+        reserve_range(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+
+        size_type inserted = 0;
+        for (auto it = first; it != last; ++it)
+        {
+            auto&& entry = *it;
+            if (insert_with_policy(std::forward<decltype(entry)>(entry).first,
+                                   std::forward<decltype(entry)>(entry).second, policy))
+            {
+                ++inserted;
+            }
+        }
+
+        return inserted;
+    }
+
+    /*!
+    @brief appends the entries of an insertion-ordered vector
+
+    Keys and values are moved into the tree; only the copy of each key kept in
+    the key index is made. Keys occurring more than once, or already present in
+    the map, are handled according to @a policy. The vector is left empty and
+    its storage is released.
+    */
+    void adopt(std::vector<std::pair<Key, T>>&& entries,
+               fifo_map_duplicate_policy policy = fifo_map_duplicate_policy::first_wins)
+    {
+        m_keys.reserve(m_keys.size() + entries.size());
+
+        for (auto& entry : entries)
+        {
+            insert_with_policy(std::move(entry.first), std::move(entry.second), policy);
+        }
+
+        std::vector<std::pair<Key, T>>().swap(entries);
+    }
+
+    /*!
+    @brief moves all entries into a vector in insertion order
+
+    Values are moved out of the map; keys are copied, as the tree only gives
+    const access to them. The map is empty afterwards. This is the inverse of
+    adopt().
+    */
+    std::vector<std::pair<Key, T>> release()
+    {
+        std::vector<std::pair<Key, T>> result;
+        result.reserve(m_map.size());
+
+        for (auto& entry : m_map)
+        {
+            result.emplace_back(entry.first, std::move(entry.second));
+        }
+
+        clear();
+        return result;
+    }
+
+    /// reserves space in the key index for at least @a count elements
+    void reserve(size_type count)
+    {
+        m_keys.reserve(count);
+    }
+
+    /// remove element at position
+    iterator erase(const_iterator pos)
+    {
+        release_hand(pos);
+        remove_key(pos->first);
+        return m_map.erase(pos);
+    }
+
+    /// remove elements in range
+    iterator erase(const_iterator first, const_iterator last)
+    {
+        for (const_iterator it = first; it != last; ++it)
+        {
+            release_hand(it);
+            remove_key(it->first);
+        }
+
+        return m_map.erase(first, last);
+    }
+
+    /// remove elements with key
+    size_type erase(const key_type& key)
+    {
+        const auto pos = m_map.find(key);
+        if (pos == m_map.end())
+        {
+            return 0;
+        }
+
+        erase(pos);
+        return 1;
+    }
+
+    /*!
+    @brief removes all elements whose keys are in a range
+
+    All keys are looked up and marked in the key index first; duplicates and
+    missing keys are skipped. Depending on how many keys were found, the marked
+    elements are then either looked up in the tree one by one, or removed in a
+    single pass over the tree, whichever needs fewer key index lookups.
+
+    @return the number of removed elements
+    */
+    template<class InputIt>
+    size_type erase_keys(InputIt first, InputIt last)
+    {
+        // timestamp 0 is never assigned and marks a key for removal
+        std::vector<std::pair<typename key_storage_type::iterator, std::size_t>> marked;
+
+        try
+        {
+            for (; first != last; ++first)
+            {
+                const auto key = m_keys.find(*first);
+                if (key != m_keys.end() && key->second != 0)
+                {
+                    marked.emplace_back(key, key->second);
+                    key->second = 0;
+                }
+            }
+        }
+        catch (...)
+        {
+            for (auto& entry : marked)
+            {
+                entry.first->second = entry.second;
+            }
+            throw;
+        }
+
+        for (auto& entry : marked)
+        {
+            untrack(entry.second);
+        }
+
+        // a tree search costs two key index lookups per level
+        size_type depth = 1;
+        for (size_type n = m_map.size(); n > 1; n >>= 1)
+        {
+            ++depth;
+        }
+
+        if (marked.size() * 2 * depth >= m_map.size())
+        {
+            for (auto it = m_map.begin(); it != m_map.end();)
+            {
+                const auto key = m_keys.find(it->first);
+                if (key->second == 0)
+                {
+                    release_hand(it);
+                    m_keys.erase(key);
+                    it = m_map.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        else
+        {
+            // the tree search needs the original timestamps
+            for (auto& entry : marked)
+            {
+                entry.first->second = entry.second;
+            }
+
+            for (auto& entry : marked)
+            {
+                const auto pos = m_map.find(entry.first->first);
+                release_hand(pos);
+                m_map.erase(pos);
+                m_keys.erase(entry.first);
+            }
+        }
+
+        return marked.size();
+    }
+
+    /*!
+    @brief removes all elements satisfying a predicate in one pass
+
+    The tree is walked once in insertion order. Matching nodes are unlinked
+    by iterator, which needs neither a tree search nor a timestamp lookup, and
+    their keys are dropped from the key index.
+
+    @return the number of removed elements
+    */
+    template<class Pred>
+    size_type erase_if(Pred pred)
+    {
+        const size_type old_size = m_map.size();
+
+        for (auto it = m_map.begin(); it != m_map.end();)
+        {
+            if (pred(*it))
+            {
+                release_hand(it);
+                remove_key(it->first);
+                it = m_map.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        return old_size - m_map.size();
+    }
+
+    /*!
+    @brief removes the oldest element; the map must not be empty
+
+    The first tree node is unlinked without a tree search or timestamp lookup;
+    only its key is removed from the key index.
+    */
+    void pop_front()
+    {
+        evict(m_map.begin());
+    }
+
+    /// removes the newest element; the map must not be empty
+    void pop_back()
+    {
+        evict(std::prev(m_map.end()));
+    }
+
+    /*!
+    @brief makes an element the newest one
+
+    The element gets a new timestamp and its node is relinked at the end of
+    the tree; the key index is updated in place and not rehashed. With C++17
+    node handles the node itself is reused, otherwise the value is moved into
+    a new node.
+
+    @return iterator to the moved element
+    */
+    iterator move_to_back(const_iterator pos)
+    {
+        return move_to_back(pos, m_keys.find(pos->first));
+    }
+
+    /*!
+    @brief makes the element with a given key the newest one
+    @return whether the key was found
+    */
+    bool touch(const Key& key)
+    {
+        const auto timestamp = m_keys.find(key);
+        if (timestamp == m_keys.end())
+        {
+            return false;
+        }
+
+        move_to_back(m_map.find(key), timestamp);
+        return true;
+    }
+
+    /*!
+    @brief releases unused memory
+
+    The key index is rehashed to the bucket count its size needs, the vectors
+    of the cache state are reallocated to their size, and a pooling allocator
+    releases the nodes it keeps for reuse.
+    */
+    void shrink_to_fit()
+    {
+        trim(m_keys.max_load_factor());
+        auto alloc = m_map.get_allocator();
+        shrink_allocator(alloc, 0);
+    }
+
+    /*!
+    @brief releases unused memory down to a target load
+
+    The key index and the element table are rehashed if they have more
+    buckets than needed for a load factor of @a target_load, and the vectors of the cache state are
+    reallocated if less than @a target_load of their capacity is used. A
+    @a target_load outside of (0, max_load_factor()] is treated as the
+    maximal load factor of the key index, which shrinks as far as possible.
+    Memory kept by the allocator is not released; see shrink_to_fit().
+    */
+    void trim(float target_load)
+    {
+        const float max_load = m_keys.max_load_factor();
+        if (!(target_load > 0.0f) || target_load > max_load)
+        {
+            target_load = max_load;
+        }
+
+        const auto wanted = static_cast<size_type>(static_cast<float>(m_keys.size()) / target_load) + 1;
+        if (m_keys.bucket_count() > wanted)
+        {
+            m_keys.rehash(wanted);
+        }
+
+        if (m_cache)
+        {
+            auto& elements = m_cache->elements;
+            const auto wanted_elements = static_cast<size_type>(static_cast<float>(elements.size()) / target_load) + 1;
+            if (elements.bucket_count() > wanted_elements)
+            {
+                elements.rehash(wanted_elements);
+            }
+
+            shrink_vector(m_cache->reclaim_list, target_load / max_load);
+        }
+    }
+
+    /// swaps the contents
+    void swap(fifo_map& other)
+    {
+        // the trees' comparators keep pointing to their own key index, whose
+        // contents are swapped along with the trees
+        m_map.swap(other.m_map);
+        m_keys.swap(other.m_keys);
+        std::swap(m_compare.m_timestamp, other.m_compare.m_timestamp);
+        m_cache.swap(other.m_cache);
+    }
+
+
+    /*
+     * Lookup
+     */
+
+    /// returns the number of elements matching specific key
+    size_type count(const Key& key) const
+    {
+        const auto timestamp = m_keys.find(key);
+        return timestamp != m_keys.end() && !expired(timestamp->second) ? 1 : 0;
+    }
+
+    /// finds element with specific key
+    iterator find(const Key& key)
+    {
+        // a missing key is settled by the key index without a tree search
+        const auto timestamp = m_keys.find(key);
+        const bool expired_hit = timestamp != m_keys.end() && expired(timestamp->second);
+        record_lookup(key, timestamp != m_keys.end() && !expired_hit);
+        if (timestamp == m_keys.end())
+        {
+            return m_map.end();
+        }
+
+        if (expired_hit)
+        {
+            remove_expired(timestamp);
+            return m_map.end();
+        }
+
+        mark_referenced(timestamp->second);
+        return m_map.find(key);
+    }
+
+    /// finds element with specific key
+    const_iterator find(const Key& key) const
+    {
+        const auto timestamp = m_keys.find(key);
+        const bool found = timestamp != m_keys.end() && !expired(timestamp->second);
+        count_lookup(found);
+        if (!found)
+        {
+            return m_map.end();
+        }
+
+        mark_referenced(timestamp->second);
+        return m_map.find(key);
+    }
+
+    /// returns range of elements matching a specific key
+    std::pair<iterator, iterator> equal_range(const Key& key)
+    {
+        return m_map.equal_range(key);
+    }
+
+    /// returns range of elements matching a specific key
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const
+    {
+        return m_map.equal_range(key);
+    }
+
+    /// returns an iterator to the first element not less than the given key
+    iterator lower_bound(const Key& key)
+    {
+        return m_map.lower_bound(key);
+    }
+
+    /// returns an iterator to the first element not less than the given key
+    const_iterator lower_bound(const Key& key) const
+    {
+        return m_map.lower_bound(key);
+    }
+
+    /// returns an iterator to the first element greater than the given key
+    iterator upper_bound(const Key& key)
+    {
+        return m_map.upper_bound(key);
+    }
+
+    /// returns an iterator to the first element greater than the given key
+    const_iterator upper_bound(const Key& key) const
+    {
+        return m_map.upper_bound(key);
+    }
+
+
+    /*
+     * Observers
+     */
+
+    /// returns the function that compares keys
+    key_compare key_comp() const
+    {
+        return m_compare;
+    }
+
+
+    /*
+     * Non-member functions
+     */
+
+    friend bool operator==(const fifo_map& lhs, const fifo_map& rhs)
+    {
+        return lhs.m_map == rhs.m_map;
+    }
+
+    friend bool operator!=(const fifo_map& lhs, const fifo_map& rhs)
+    {
+        return lhs.m_map != rhs.m_map;
+    }
+
+    friend bool operator<(const fifo_map& lhs, const fifo_map& rhs)
+    {
+        return lhs.m_map < rhs.m_map;
+    }
+
+    friend bool operator<=(const fifo_map& lhs, const fifo_map& rhs)
+    {
+        return lhs.m_map <= rhs.m_map;
+    }
+
+    friend bool operator>(const fifo_map& lhs, const fifo_map& rhs)
+    {
+        return lhs.m_map > rhs.m_map;
+    }
+
+    friend bool operator>=(const fifo_map& lhs, const fifo_map& rhs)
+    {
+        return lhs.m_map >= rhs.m_map;
+    }
+
+  private:
+    /// the state of an element needed by expiry, weights, or the CLOCK policy
+    struct element_state
+    {
+        element_state() noexcept
+            : deadline(), weight(0), referenced(false)
+        {}
+
+        /// copy constructor
+        element_state(const element_state& other) noexcept
+            : deadline(other.deadline), weight(other.weight),
+              referenced(other.referenced.load(std::memory_order_relaxed))
+        {}
+
+        /// copy assignment
+        element_state& operator=(const element_state& other) noexcept
+        {
+            deadline = other.deadline;
+            weight = other.weight;
+            referenced.store(other.referenced.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+
+        /// the time the element expires; only maintained while a TTL is set
+        time_point deadline;
+        /// the weight last measured by the weigher; 0 without a weigher
+        std::size_t weight;
+        /// the reference bit of the CLOCK policy
+        std::atomic<bool> referenced;
+    };
+
+    /// the element states, keyed by the timestamps of the elements
+    using element_table = std::unordered_map<std::size_t, element_state>;
+
+    /// settings and bookkeeping of the cache modes
+    struct cache_state
+    {
+        /// the maximal number of elements; 0 means unbounded
+        size_type capacity = 0;
+        /// how the element to evict is chosen
+        fifo_map_eviction_policy policy = fifo_map_eviction_policy::fifo;
+        /// the function receiving evicted elements
+        eviction_callback on_evict {};
+        /// the time to live of new elements; zero means no expiry
+        duration ttl = duration::zero();
+        /// the clock; steady_clock if empty
+        std::function<time_point()> clock {};
+        /// the function measuring the weight of an element
+        weigher_type weigher {};
+        /// the maximal total weight; 0 means unbounded
+        std::size_t max_weight = 0;
+        /// the total weight of all elements
+        std::size_t total_weight = 0;
+        /// whether operation counters are collected
+        bool record_stats = false;
+        /// the operation counters
+        fifo_map_stats_counters stats {};
+        /// whether a full map accepts new keys
+        fifo_map_admission_policy admission = fifo_map_admission_policy::always;
+        /// the usage frequencies for the admission policy
+        fifo_map_frequency_sketch sketch {};
+        /// whether evicted values are kept for reclaim()
+        bool defer_reclaim = false;
+        /// the evicted values not yet destroyed
+        std::vector<T> reclaim_list {};
+        /// whether the element table holds an entry for every element
+        bool tracking = false;
+        /// the per-element state; only kept while tracking
+        element_table elements {};
+        /// whether hand points to an element
+        bool hand_set = false;
+        /// the next element the CLOCK policy inspects
+        iterator hand {};
+        /// the newest timestamp the hand inspects before wrapping around
+        std::size_t sweep_end = 0;
+    };
+
+    /*!
+    @brief records the insertion timestamp of a new key
+    @return the key's entry in the key index and whether it was added
+    */
+    std::pair<typename key_storage_type::iterator, bool> add_key(const Key& key)
+    {
+        // look up first: inserting an existing key would allocate a node
+        const auto timestamp = m_keys.find(key);
+        if (timestamp != m_keys.end())
+        {
+            return {timestamp, false};
+        }
+
+        return m_keys.emplace(key, new_timestamp());
+    }
+
+    /*!
+    @brief inserts a value unless its key exists
+
+    A new key carries the newest timestamp, so its node belongs at the end of
+    the tree and can be inserted with the end as hint in amortized constant
+    time.
+    */
+    template<class V>
+    std::pair<iterator, bool> insert_back(V&& value)
+    {
+        const auto added = add_key(value.first);
+        if (!added.second)
+        {
+            return {m_map.find(value.first), false};
+        }
+
+        if (!admit(value.first))
+        {
+            m_keys.erase(added.first);
+            return {m_map.end(), false};
+        }
+
+        return {append(added.first, std::forward<V>(value)), true};
+    }
+
+    /*!
+    @brief inserts or updates a value according to a duplicate policy
+    @return whether the key was new
+    */
+    template<class K, class V>
+    bool insert_with_policy(K&& key, V&& value, fifo_map_duplicate_policy policy)
+    {
+        const auto timestamp = m_keys.find(key);
+        if (timestamp == m_keys.end())
+        {
+            if (!admit(key))
+            {
+                return false;
+            }
+
+            const auto record = m_keys.emplace(key, new_timestamp()).first;
+            append(record, std::forward<K>(key), std::forward<V>(value));
+            return true;
+        }
+
+        switch (policy)
+        {
+            case fifo_map_duplicate_policy::first_wins:
+                break;
+
+            case fifo_map_duplicate_policy::last_wins:
+                assign(m_map.find(key), std::forward<V>(value));
+                break;
+
+            case fifo_map_duplicate_policy::last_wins_moves_to_end:
+                assign(move_to_back(m_map.find(key), timestamp), std::forward<V>(value));
+                break;
+        }
+
+        return false;
+    }
+
+    /// relinks the node at @a pos with timestamp entry @a timestamp at the end
+    iterator move_to_back(const_iterator pos, typename key_storage_type::iterator timestamp)
+    {
+        const auto old_timestamp = timestamp->second;
+        iterator result;
+
+        if (std::next(pos) == m_map.end())
+        {
+            // already the newest element; a fresh timestamp keeps it last
+            timestamp->second = new_timestamp();
+            result = m_map.erase(pos, pos);
+        }
+        else
+        {
+            // unlinking by iterator does not consult the timestamps
+            release_hand(pos);
+#if defined(__cpp_lib_node_extract)
+            auto node = m_map.extract(pos);
+            timestamp->second = new_timestamp();
+            result = m_map.insert(m_map.end(), std::move(node));
+#else
+            T value = std::move(const_cast<T&>(pos->second));
+            m_map.erase(pos);
+            timestamp->second = new_timestamp();
+            result = m_map.emplace_hint(m_map.end(), timestamp->first, std::move(value));
+#endif
+        }
+
+        if (m_cache && m_cache->tracking)
+        {
+            retrack(old_timestamp, timestamp->second);
+        }
+
+        return result;
+    }
+
+    /*!
+    @brief appends a node for a key just added to the key index as @a record
+
+    Up to two expired elements are removed first. This is the only place
+    besides expire() that sweeps: the caller holds no tree iterator yet, and
+    no eviction is in progress, so the sweep cannot invalidate anything.
+    */
+    template<class... Args>
+    iterator append(typename key_storage_type::iterator record, Args&& ... args)
+    {
+        if (m_cache && m_cache->ttl > duration::zero())
+        {
+            expire(now(), 2);
+        }
+
+        auto it = m_map.emplace_hint(m_map.end(), std::forward<Args>(args)...);
+
+        if (m_cache)
+        {
+            if (m_cache->record_stats)
+            {
+                fifo_map_stats_counters::increment(m_cache->stats.inserts);
+            }
+
+            track(record->second, *it);
+            it = enforce_capacity(it);
+        }
+
+        return it;
+    }
+
+    /// assigns a value to the element at @a pos and measures it again
+    template<class V>
+    iterator assign(iterator pos, V&& value)
+    {
+        if (const auto stats = recorder())
+        {
+            fifo_map_stats_counters::increment(stats->overwrites);
+        }
+
+        if (m_cache && m_cache->weigher)
+        {
+            auto& element = element_of(m_keys.find(pos->first)->second);
+            m_cache->total_weight -= element.weight;
+            pos->second = std::forward<V>(value);
+            add_weight(element, *pos);
+            return enforce_capacity(pos);
+        }
+
+        pos->second = std::forward<V>(value);
+        return pos;
+    }
+
+    /// returns the counters to update, or nullptr if collection is disabled
+    fifo_map_stats_counters* recorder() const noexcept
+    {
+        return m_cache && m_cache->record_stats ? &m_cache->stats : nullptr;
+    }
+
+    /// counts a lookup in the operation counters only; safe on a const map
+    void count_lookup(bool hit) const noexcept
+    {
+        if (const auto stats = recorder())
+        {
+            fifo_map_stats_counters::increment(stats->lookups);
+            fifo_map_stats_counters::increment(hit ? stats->hits : stats->misses);
+        }
+    }
+
+    /// counts a lookup of @a key, also in the sketch of the admission policy
+    void record_lookup(const Key& key, bool hit)
+    {
+        count_lookup(hit);
+
+        if (m_cache && m_cache->admission == fifo_map_admission_policy::tinylfu)
+        {
+            m_cache->sketch.increment(m_keys.hash_function()(key));
+        }
+    }
+
+    /*!
+    @brief counts an insertion attempt and decides whether to accept the key
+
+    A full map with the TinyLFU admission policy accepts a new key only if
+    the sketch estimates it to be used more often than the oldest element.
+    */
+    bool admit(const Key& key)
+    {
+        if (!m_cache || m_cache->admission != fifo_map_admission_policy::tinylfu)
+        {
+            return true;
+        }
+
+        const auto hash = m_keys.hash_function();
+        const auto key_hash = hash(key);
+        auto& sketch = m_cache->sketch;
+        sketch.increment(key_hash);
+
+        if (m_cache->capacity == 0 || m_map.size() < m_cache->capacity || m_map.empty()
+                || sketch.estimate(key_hash) > sketch.estimate(hash(m_map.begin()->first)))
+        {
+            return true;
+        }
+
+        if (const auto stats = recorder())
+        {
+            fifo_map_stats_counters::increment(stats->rejections);
+        }
+        return false;
+    }
+
+    /*!
+    @brief keeps the element table while expiry, a weigher, or CLOCK need it
+
+    Entries are created for all present elements when the table is first
+    needed, and the table is released once no mode needs it, so maps without
+    these modes pay nothing per element.
+    */
+    void update_tracking()
+    {
+        auto& state = *m_cache;
+        const bool needed = state.ttl > duration::zero() || state.weigher
+                            || state.policy == fifo_map_eviction_policy::clock;
+
+        if (needed && !state.tracking)
+        {
+            state.elements.reserve(m_keys.size());
+            for (const auto& entry : m_keys)
+            {
+                state.elements.emplace(entry.second, element_state());
+            }
+        }
+        else if (!needed && state.tracking)
+        {
+            element_table().swap(state.elements);
+        }
+
+        state.tracking = needed;
+    }
+
+    /// returns the element table entry of the element with @a timestamp
+    /// @pre the element table is kept
+    element_state& element_of(std::size_t timestamp) const
+    {
+        return m_cache->elements.find(timestamp)->second;
+    }
+
+    /// adds the element table entry of a new element
+    void track(std::size_t timestamp, const value_type& value)
+    {
+        if (m_cache->tracking)
+        {
+            auto& element = m_cache->elements[timestamp];
+            set_deadline(element);
+            add_weight(element, value);
+        }
+    }
+
+    /*!
+    @brief moves an element table entry to the new timestamp of its element
+
+    The deadline is renewed and the reference bit cleared.
+    */
+    void retrack(std::size_t from, std::size_t to)
+    {
+        auto& elements = m_cache->elements;
+#if defined(__cpp_lib_node_extract)
+        auto node = elements.extract(from);
+        node.key() = to;
+        auto& element = elements.insert(std::move(node)).position->second;
+#else
+        const auto pos = elements.find(from);
+        const element_state moved = pos->second;
+        elements.erase(pos);
+        auto& element = elements.emplace(to, moved).first->second;
+#endif
+        element.referenced.store(false, std::memory_order_relaxed);
+        set_deadline(element);
+    }
+
+    /// removes the element table entry of an element and its weight
+    void untrack(std::size_t timestamp)
+    {
+        if (m_cache && m_cache->tracking)
+        {
+            const auto pos = m_cache->elements.find(timestamp);
+            m_cache->total_weight -= pos->second.weight;
+            m_cache->elements.erase(pos);
+        }
+    }
+
+    /// measures @a value, stores its weight in @a element, and adds it to the total weight
+    void add_weight(element_state& element, const value_type& value)
+    {
+        if (m_cache->weigher)
+        {
+            element.weight = m_cache->weigher(value.first, value.second);
+            m_cache->total_weight += element.weight;
+        }
+    }
+
+    /// removes @a key from the key index and the element table
+    void remove_key(const Key& key)
+    {
+        const auto record = m_keys.find(key);
+        untrack(record->second);
+        m_keys.erase(record);
+    }
+
+    /// returns a timestamp newer than all previous ones
+    std::size_t new_timestamp() noexcept
+    {
+        return m_compare.m_timestamp++;
+    }
+
+    /// records a hit on the element with @a timestamp; safe on a const map
+    void mark_referenced(std::size_t timestamp) const
+    {
+        if (m_cache && m_cache->policy == fifo_map_eviction_policy::clock)
+        {
+            element_of(timestamp).referenced.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    /// moves the CLOCK hand off the element at @a pos before it is unlinked
+    void release_hand(const_iterator pos) noexcept
+    {
+        if (m_cache && m_cache->hand_set && m_cache->hand == pos)
+        {
+            ++m_cache->hand;
+            m_cache->hand_set = m_cache->hand != m_map.end();
+        }
+    }
+
+    /*!
+    @brief returns the element to evict next according to the eviction policy
+    @param[in] keep  an element that must not be chosen, or end()
+    @pre the map holds another element than @a keep
+    */
+    iterator victim(iterator keep)
+    {
+        if (m_cache && m_cache->policy == fifo_map_eviction_policy::clock)
+        {
+            // the hand passes referenced elements, clearing their bits; it
+            // finds an unreferenced element within two rounds at the latest
+            auto& state = *m_cache;
+            auto it = state.hand_set ? state.hand : m_map.end();
+            for (;; ++it)
+            {
+                std::size_t timestamp = it == m_map.end() ? 0 : m_keys.find(it->first)->second;
+
+                // elements added since the hand last wrapped around sit behind
+                // it, like a new entry taking the slot of its victim
+                if (it == m_map.end() || timestamp > state.sweep_end)
+                {
+                    it = m_map.begin();
+                    timestamp = m_keys.find(it->first)->second;
+                    state.sweep_end = m_compare.m_timestamp - 1;
+                    if (keep != m_map.end() && std::next(keep) == m_map.end())
+                    {
+                        state.sweep_end = m_keys.find(keep->first)->second - 1;
+                    }
+                }
+
+                if (it != keep)
+                {
+                    auto& referenced = element_of(timestamp).referenced;
+                    if (!referenced.load(std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                    referenced.store(false, std::memory_order_relaxed);
+                }
+            }
+
+            // evict() moves the hand on to the next element
+            state.hand = it;
+            state.hand_set = true;
+            return it;
+        }
+
+        const auto front = m_map.begin();
+        return front == keep ? std::next(front) : front;
+    }
+
+    /// returns the current time of the configured clock
+    time_point now() const
+    {
+        return m_cache && m_cache->clock ? m_cache->clock() : clock_type::now();
+    }
+
+    /*!
+    @brief sets the deadline of @a element
+
+    Only records; sweeping here could evict elements the caller still holds,
+    e.g., the element enforce_capacity() must keep.
+    */
+    void set_deadline(element_state& element)
+    {
+        if (m_cache->ttl > duration::zero())
+        {
+            element.deadline = now() + m_cache->ttl;
+        }
+    }
+
+    /*!
+    @brief removes up to @a limit expired elements from the front
+
+    With a uniform time to live, deadlines grow with the timestamps, so only
+    the front element needs to be checked. Each step costs one key index and
+    one element table lookup and either removes an element or stops.
+    */
+    size_type expire(time_point now, size_type limit)
+    {
+        if (!m_cache || m_cache->ttl <= duration::zero())
+        {
+            return 0;
+        }
+
+        size_type expired = 0;
+        while (expired < limit && !m_map.empty()
+                && element_of(m_keys.find(m_map.begin()->first)->second).deadline <= now)
+        {
+            evict(m_map.begin());
+            ++expired;
+
+            if (const auto stats = recorder())
+            {
+                fifo_map_stats_counters::increment(stats->expirations);
+            }
+        }
+
+        return expired;
+    }
+
+    /// returns whether the element with @a timestamp is past its deadline
+    bool expired(std::size_t timestamp) const
+    {
+        return m_cache && m_cache->ttl > duration::zero() && element_of(timestamp).deadline <= now();
+    }
+
     /*!
-    This function compares two keys with respect to the order in which they
-    were added to the container. For this, the mapping keys is used.
+    @brief removes the expired element with key index entry @a record
+
+    As deadlines follow insertion order, the elements in front of it expired
+    as well, and up to two of them are removed, too.
     */
-    bool operator()(const Key& lhs, const Key& rhs) const
+    void remove_expired(typename key_storage_type::iterator record)
     {
-        // look up timestamps for both keys
-        const auto timestamp_lhs = m_keys->find(lhs);
-        const auto timestamp_rhs = m_keys->find(rhs);
+        evict(m_map.find(record->first));
 
-        if (timestamp_lhs == m_keys->end())
+        if (const auto stats = recorder())
         {
-            // timestamp for lhs not found - cannot be smaller than for rhs
-            return false;
+            fifo_map_stats_counters::increment(stats->expirations);
         }
 
-        if (timestamp_rhs == m_keys->end())
+        expire(now(), 2);
+    }
+
+    /// removes the element at @a pos and hands it to the eviction callback
+    void evict(iterator pos)
+    {
+        const auto record = m_keys.find(pos->first);
+        untrack(record->second);
+
+        if (m_cache && m_cache->on_evict)
+        {
+            m_cache->on_evict(pos->first, std::move(pos->second));
+        }
+        else if (m_cache && m_cache->defer_reclaim)
+        {
+            m_cache->reclaim_list.push_back(std::move(pos->second));
+        }
+
+        release_hand(pos);
+        m_keys.erase(record);
+        m_map.erase(pos);
+    }
+
+    /// returns whether the map exceeds its capacity or weight budget
+    bool over_budget() const noexcept
+    {
+        if (m_cache->capacity != 0 && m_map.size() > m_cache->capacity)
         {
-            // timestamp for rhs not found - timestamp for lhs is smaller
             return true;
         }
 
-        // compare timestamps
-        return timestamp_lhs->second < timestamp_rhs->second;
+        // the newest element is never evicted for its weight
+        return m_cache->max_weight != 0 && m_cache->total_weight > m_cache->max_weight
+               && m_map.size() > 1;
     }
 
-    void add_key(const Key& key)
+    /*!
+    @brief evicts elements while the map exceeds its capacity or weight budget
+    @param[in] keep  an element that must not be evicted, or end()
+    @return @a keep
+    */
+    iterator enforce_capacity(iterator keep)
     {
-        m_keys->insert({key, m_timestamp++});
+        if (m_cache)
+        {
+            while (over_budget())
+            {
+                evict(victim(keep));
+
+                if (const auto stats = recorder())
+                {
+                    fifo_map_stats_counters::increment(stats->evictions);
+                }
+            }
+        }
+
+        return keep;
     }
 
-    void remove_key(const Key& key)
+    /// returns the cache state, creating it on first use
+    cache_state& cache()
     {
-        m_keys->erase(key);
+        if (!m_cache)
+        {
+            m_cache.reset(new cache_state());
+        }
+        return *m_cache;
     }
 
-  private:
-    /// helper to access m_timestamp from fifo_map copy ctor,
-    /// must have same number of template args as fifo_map
-    template <
-        class MapKey,
-        class MapT,
-        class MapCompare,
-        class MapAllocator
-        > friend class fifo_map;
+    /// reserves the key index for a range of known length
+    template<class ForwardIt>
+    void reserve_range(ForwardIt first, ForwardIt last, std::forward_iterator_tag)
+    {
+        m_keys.reserve(m_keys.size() + static_cast<size_type>(std::distance(first, last)));
+    }
+
+    /// single-pass ranges cannot be measured in advance
+    template<class InputIt>
+    void reserve_range(InputIt, InputIt, std::input_iterator_tag) {}
+
+    /// reallocates @a vec if less than @a load of its capacity is used
+    template<class V>
+    static void shrink_vector(std::vector<V>& vec, float load)
+    {
+        const auto wanted = static_cast<std::size_t>(static_cast<float>(vec.size()) / load);
+        if (vec.capacity() > std::max(wanted, vec.size()))
+        {
+            std::vector<V> shrunk;
+            shrunk.reserve(std::max(wanted, vec.size()));
+            std::move(vec.begin(), vec.end(), std::back_inserter(shrunk));
+            vec.swap(shrunk);
+        }
+    }
+
+    /// returns the size of the heap block serving a request of @a bytes bytes
+    static std::size_t heap_block(std::size_t bytes) noexcept
+    {
+        const std::size_t granularity = 2 * sizeof(void*);
+        const std::size_t block = (bytes + sizeof(void*) + granularity - 1) / granularity * granularity;
+        return std::max(block, 2 * granularity);
+    }
+
+    /// converts the map's allocator for the key index if possible
+    template<class Alloc>
+    static auto make_key_allocator(const Alloc& alloc, int) -> decltype(key_allocator_type(alloc))
+    {
+        return key_allocator_type(alloc);
+    }
+
+    /// a comparator with another allocator keeps a default-constructed one
+    template<class Alloc>
+    static key_allocator_type make_key_allocator(const Alloc&, long)
+    {
+        return key_allocator_type();
+    }
+
+    /// calls shrink_to_fit() on allocators which provide it
+    template<class Alloc>
+    static auto shrink_allocator(Alloc& alloc, int) -> decltype(alloc.shrink_to_fit(), void())
+    {
+        alloc.shrink_to_fit();
+    }
+
+    /// fallback for allocators without shrink_to_fit()
+    template<class Alloc>
+    static void shrink_allocator(Alloc&, long) {}
 
   private:
-    /// the next valid insertion timestamp
-    std::size_t m_timestamp = 1;
+    /// the keys
+    key_storage_type m_keys;
+    /// the comparison object
+    Compare m_compare;
+    /// the internal data structure
+    internal_map_type m_map;
 
-    /// pointer to a mapping from keys to insertion timestamps
-    std::unordered_map<Key, std::size_t>* m_keys = nullptr;
+    /// the cache state; only allocated once a cache mode is used
+    std::unique_ptr<cache_state> m_cache;
 };
 
+/// removes all elements satisfying a predicate
+template<class Key, class T, class Compare, class Allocator, class Pred>
+typename fifo_map<Key, T, Compare, Allocator>::size_type
+erase_if(fifo_map<Key, T, Compare, Allocator>& m, Pred pred)
+{
+    return m.erase_if(pred);
+}
 
-template <
-    class Key,
-    class T,
-    class Compare = fifo_map_compare<Key>,
-    class Allocator = std::allocator<std::pair<const Key, T>>
-    > class fifo_map
+/*!
+@brief handle to a string stored in a fifo_map_key_pool
+
+A handle consists of a pointer to the pooled string and its precomputed hash
+value, so copying, hashing and comparing handles from the same pool never
+touches the characters. The pool must outlive all handles it created.
+*/
+class fifo_map_interned_key
 {
   public:
-    using key_type = Key;
-    using mapped_type = T;
-    using value_type = std::pair<const Key, T>;
-    using size_type = std::size_t;
-    using difference_type = std::ptrdiff_t;
-    using key_compare = Compare;
-    using allocator_type = Allocator;
-    using reference = value_type&;
-    using const_reference = const value_type&;
-    using pointer = typename std::allocator_traits<Allocator>::pointer;
-    using const_pointer = typename std::allocator_traits<Allocator>::const_pointer;
+    /// returns the interned string
+    const std::string& str() const noexcept
+    {
+        return *m_string;
+    }
 
-    using internal_map_type = std::map<Key, T, Compare, Allocator>;
+    /// returns the interned string
+    operator const std::string& () const noexcept
+    {
+        return *m_string;
+    }
 
-    using iterator = typename internal_map_type::iterator;
-    using const_iterator = typename internal_map_type::const_iterator;
-    using reverse_iterator = typename internal_map_type::reverse_iterator;
-    using const_reverse_iterator = typename internal_map_type::const_reverse_iterator;
+    /// returns the precomputed hash value
+    std::size_t hash() const noexcept
+    {
+        return m_hash;
+    }
+
+    friend bool operator==(const fifo_map_interned_key& lhs, const fifo_map_interned_key& rhs) noexcept
+    {
+        // handles from the same pool are equal iff they point to the same string
+        return lhs.m_string == rhs.m_string ||
+               (lhs.m_hash == rhs.m_hash && *lhs.m_string == *rhs.m_string);
+    }
+
+    friend bool operator!=(const fifo_map_interned_key& lhs, const fifo_map_interned_key& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+    friend bool operator<(const fifo_map_interned_key& lhs, const fifo_map_interned_key& rhs) noexcept
+    {
+        return *lhs.m_string < *rhs.m_string;
+    }
+
+  private:
+    friend class fifo_map_key_pool;
 
+    fifo_map_interned_key(const std::string* string, std::size_t hash) noexcept
+        : m_string(string), m_hash(hash)
+    {}
+
+    /// the interned string
+    const std::string* m_string;
+    /// the hash value of the string
+    std::size_t m_hash;
+};
+
+/*!
+@brief pool of strings shared by many fifo_map<fifo_map_interned_key, T>
+
+Each distinct string is stored once, no matter how many maps use it as key.
+Strings are only freed when the pool is destroyed.
+*/
+class fifo_map_key_pool
+{
   public:
     /// default constructor
-    fifo_map() : m_keys(), m_compare(&m_keys), m_map(m_compare) {}
+    fifo_map_key_pool() : m_strings(), m_handles() {}
 
-    /// copy constructor
-    fifo_map(const fifo_map &f) : m_keys(f.m_keys), m_compare(&m_keys, f.m_compare.m_timestamp), m_map(f.m_map.begin(), f.m_map.end(), m_compare) {}
+    /// returns the handle for @a key, adding it to the pool if needed
+    fifo_map_interned_key intern(const std::string& key)
+    {
+        return add(key);
+    }
 
-    /// constructor for a range of elements
-    template<class InputIterator>
-    fifo_map(InputIterator first, InputIterator last)
-        : m_keys(), m_compare(&m_keys), m_map(m_compare)
+    /// returns the handle for @a key, adding it to the pool if needed
+    fifo_map_interned_key intern(std::string&& key)
     {
-        for (auto it = first; it != last; ++it)
+        return add(std::move(key));
+    }
+
+    /*!
+    @brief returns the handle for @a key without adding it
+
+    @return pointer to the handle, valid as long as the pool, or nullptr if
+            @a key is not in the pool; a map cannot hold such a key, so
+            lookups with unknown strings need not grow the pool
+    */
+    const fifo_map_interned_key* find(const std::string& key) const
+    {
+        const auto it = m_handles.find(fifo_map_interned_key(&key, std::hash<std::string>()(key)));
+        return it == m_handles.end() ? nullptr : &*it;
+    }
+
+    /// returns the number of distinct strings in the pool
+    std::size_t size() const noexcept
+    {
+        return m_handles.size();
+    }
+
+  private:
+    /// hashes a handle with its precomputed hash value
+    struct handle_hash
+    {
+        std::size_t operator()(const fifo_map_interned_key& key) const noexcept
         {
-            insert(*it);
+            return key.hash();
         }
-    }
+    };
 
-    /// constructor for a list of elements
-    fifo_map(std::initializer_list<value_type> init) : fifo_map()
+    /// returns the handle for @a key, hashing it once
+    template<class String>
+    fifo_map_interned_key add(String&& key)
     {
-        for (auto x : init)
+        const fifo_map_interned_key probe(&key, std::hash<std::string>()(key));
+        const auto it = m_handles.find(probe);
+        if (it != m_handles.end())
         {
-            insert(x);
+            return *it;
         }
+
+        m_strings.push_back(std::forward<String>(key));
+        return *m_handles.insert(fifo_map_interned_key(&m_strings.back(), probe.hash())).first;
     }
 
+    /// the interned strings; a deque keeps their addresses when growing
+    std::deque<std::string> m_strings;
+    /// the handles of the interned strings
+    std::unordered_set<fifo_map_interned_key, handle_hash> m_handles;
+};
 
-    /*
-     * Element access
-     */
+/*!
+@brief immutable key sequence shared by shaped_fifo_map objects
+
+A shape describes the keys of a map in insertion order and maps each key to
+its slot in the values array. Adding a key to a map moves it to a child shape,
+which is created once and then cached in its parent, so all maps built with
+the same key sequence end up sharing one shape. Shapes are owned by their root
+and live as long as the root or any map using one of them; pointers handed out
+by add() keep the whole tree alive, including every key sequence ever added.
+Const member functions only read a shape, but add() modifies the tree: while one
+map sharing a root is modified, no other map sharing it may be used.
+*/
+template<class Key>
+class fifo_map_shape
+{
+  public:
+    using pointer = std::shared_ptr<fifo_map_shape>;
 
-    /// access specified element with bounds checking
-    T& at(const Key& key)
+    /// returns "not found" for find()
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    fifo_map_shape(const fifo_map_shape&) = delete;
+    fifo_map_shape& operator=(const fifo_map_shape&) = delete;
+
+    /// creates an empty root shape
+    static pointer make_root()
     {
-        return m_map.at(key);
+        pointer root(new fifo_map_shape(nullptr, nullptr, 0));
+        root->m_index.reset(new path_index());
+        return root;
     }
 
-    /// access specified element with bounds checking
-    const T& at(const Key& key) const
+    /// returns the number of keys
+    std::size_t size() const noexcept
     {
-        return m_map.at(key);
+        return m_size;
     }
 
-    /// access specified element
-    T& operator[](const Key& key)
+    /// returns the slot of @a key or npos
+    std::size_t find(const Key& key) const
     {
-        m_compare.add_key(key);
-        return m_map[key];
+        const auto& slots = index().slots;
+        const auto it = slots.find(std::cref(key));
+        // the index may be shared with descendants holding more keys
+        return it == slots.end() || it->second >= m_size ? npos : it->second;
     }
 
-    /// access specified element
-    T& operator[](Key&& key)
+    /// returns the key stored in @a slot
+    const Key& key(std::size_t slot) const
     {
-        m_compare.add_key(key);
-        return m_map[key];
+        return *index().keys[slot];
     }
 
+    /// returns the shape with @a key appended; @a self must own this shape
+    static pointer add(const pointer& self, const Key& key)
+    {
+        auto& child = self->m_transitions[key];
+        if (child == nullptr)
+        {
+            child.reset(new fifo_map_shape(self.get(), &key, self->m_size + 1));
+            child->build_index();
+        }
 
-    /*
-     * Iterators
-     */
+        // share ownership of the root
+        return pointer(self, child.get());
+    }
 
-    /// returns an iterator to the beginning
-    iterator begin() noexcept
+  private:
+    /// the keys of a path of shapes; a shape uses the first size() of them
+    struct path_index
     {
-        return m_map.begin();
-    }
+        /// the keys in insertion order
+        std::vector<const Key*> keys {};
+        /// the mapping from keys to slots
+        std::unordered_map<std::reference_wrapper<const Key>, std::size_t, std::hash<Key>, std::equal_to<Key>> slots {};
+    };
+
+    fifo_map_shape(const fifo_map_shape* parent, const Key* key, std::size_t size)
+        : m_parent(parent), m_key(key == nullptr ? nullptr : new Key(*key)),
+          m_size(size), m_transitions(), m_index()
+    {}
 
-    /// returns an iterator to the end
-    iterator end() noexcept
+    /// returns the index of this shape
+    const path_index& index() const noexcept
     {
-        return m_map.end();
+        return *m_index;
     }
 
-    /// returns an iterator to the beginning
-    const_iterator begin() const noexcept
+    /*!
+    @brief creates the index of a new shape
+
+    If the parent's index ends with the parent, this shape appends its key to
+    it and shares it, so a map growing key by key keeps a single index for
+    all its intermediate shapes. Otherwise, e.g. for a second child of the
+    same parent, the keys are collected along the path from the root. The
+    index is built here rather than on first lookup so const member functions
+    never modify a shape.
+    */
+    void build_index()
     {
-        return m_map.begin();
+        const auto& parent_index = m_parent->m_index;
+        if (parent_index->keys.size() == m_parent->m_size)
+        {
+            parent_index->slots.emplace(std::cref(*m_key), m_size - 1);
+            parent_index->keys.push_back(m_key.get());
+            m_index = parent_index;
+            return;
+        }
+
+        std::shared_ptr<path_index> result(new path_index());
+        result->keys.resize(m_size);
+        result->slots.reserve(m_size);
+        const fifo_map_shape* shape = this;
+        for (std::size_t slot = m_size; slot > 0; --slot, shape = shape->m_parent)
+        {
+            result->keys[slot - 1] = shape->m_key.get();
+            result->slots.emplace(std::cref(*shape->m_key), slot - 1);
+        }
+        m_index = std::move(result);
     }
 
-    /// returns an iterator to the end
-    const_iterator end() const noexcept
+    /// the shape this shape was derived from
+    const fifo_map_shape* m_parent;
+    /// the key added by this shape
+    std::unique_ptr<const Key> m_key;
+    /// the number of keys
+    std::size_t m_size;
+    /// the cached child shapes, one per added key
+    std::unordered_map<Key, std::unique_ptr<fifo_map_shape>> m_transitions;
+    /// the index of the keys; shared along a path of shapes
+    std::shared_ptr<path_index> m_index;
+};
+
+template<class Key>
+constexpr std::size_t fifo_map_shape<Key>::npos;
+
+/*!
+@brief FIFO-ordered map storing only a values array and a shared shape
+
+Maps created from the same root shape and with an identical key sequence share
+one fifo_map_shape, so the key index costs a single pointer per map. Appending
+a key follows a cached transition; erasing a key rebuilds the map's shape from
+the root and takes linear time. A default-constructed map has a root of its own
+and shares nothing; pass a common root to share shapes.
+*/
+template<class Key, class T>
+class shaped_fifo_map
+{
+  private:
+    template<bool Const>
+    class iterator_impl
     {
-        return m_map.end();
+      public:
+        using map_pointer = typename std::conditional<Const, const shaped_fifo_map*, shaped_fifo_map*>::type;
+        using mapped_reference = typename std::conditional<Const, const T&, T&>::type;
+        using value_type = std::pair<const Key&, mapped_reference>;
+        using reference = value_type;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        /// holds the pair returned by operator->, as there is no stored pair to point to
+        class pointer
+        {
+          public:
+            explicit pointer(reference ref) noexcept
+                : m_ref(ref)
+            {}
+
+            const value_type* operator->() const noexcept
+            {
+                return &m_ref;
+            }
+
+          private:
+            value_type m_ref;
+        };
+
+        iterator_impl() noexcept
+            : m_map(nullptr), m_slot(0)
+        {}
+
+        iterator_impl(map_pointer map, std::size_t slot) noexcept
+            : m_map(map), m_slot(slot)
+        {}
+
+        /// converting constructor from iterator to const_iterator
+        template<bool OtherConst, class = typename std::enable_if<Const && !OtherConst>::type>
+        iterator_impl(const iterator_impl<OtherConst>& other) noexcept
+            : m_map(other.m_map), m_slot(other.m_slot)
+        {}
+
+        /// returns the key
+        const Key& key() const
+        {
+            return m_map->m_shape->key(m_slot);
+        }
+
+        /// returns the value
+        mapped_reference value() const
+        {
+            return m_map->m_values[m_slot];
+        }
+
+        reference operator*() const
+        {
+            return reference(key(), value());
+        }
+
+        pointer operator->() const
+        {
+            return pointer(**this);
+        }
+
+        iterator_impl& operator++() noexcept
+        {
+            ++m_slot;
+            return *this;
+        }
+
+        iterator_impl operator++(int) noexcept
+        {
+            auto result = *this;
+            ++m_slot;
+            return result;
+        }
+
+        friend bool operator==(const iterator_impl& lhs, const iterator_impl& rhs) noexcept
+        {
+            return lhs.m_map == rhs.m_map && lhs.m_slot == rhs.m_slot;
+        }
+
+        friend bool operator!=(const iterator_impl& lhs, const iterator_impl& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+      private:
+        friend class shaped_fifo_map;
+        template<bool> friend class iterator_impl;
+
+        /// the map iterated over
+        map_pointer m_map;
+        /// the current slot
+        std::size_t m_slot;
+    };
+
+  public:
+    using key_type = Key;
+    using mapped_type = T;
+    using size_type = std::size_t;
+    using shape_type = fifo_map_shape<Key>;
+    using shape_pointer = typename shape_type::pointer;
+    using iterator = iterator_impl<false>;
+    using const_iterator = iterator_impl<true>;
+
+    /// default constructor; creates a root shape of its own
+    shaped_fifo_map() : shaped_fifo_map(shape_type::make_root()) {}
+
+    /// constructor given a root shape
+    explicit shaped_fifo_map(shape_pointer root)
+        : m_root(root), m_shape(std::move(root)), m_values()
+    {}
+
+    /// constructor for a list of elements
+    shaped_fifo_map(std::initializer_list<std::pair<const Key, T>> init) : shaped_fifo_map()
+    {
+        for (const auto& x : init)
+        {
+            insert(x.first, x.second);
+        }
     }
 
-    /// returns an iterator to the beginning
-    const_iterator cbegin() const noexcept
+    /// constructor given a root shape and a list of elements
+    shaped_fifo_map(shape_pointer root, std::initializer_list<std::pair<const Key, T>> init)
+        : shaped_fifo_map(std::move(root))
     {
-        return m_map.cbegin();
+        for (const auto& x : init)
+        {
+            insert(x.first, x.second);
+        }
     }
 
-    /// returns an iterator to the end
-    const_iterator cend() const noexcept
+
+    /*
+     * Element access
+     */
+
+    /// access specified element with bounds checking
+    T& at(const Key& key)
     {
-        return m_map.cend();
+        const auto slot = m_shape->find(key);
+        if (slot == shape_type::npos)
+        {
+            throw std::out_of_range("key not found");
+        }
+        return m_values[slot];
     }
 
-    /// returns a reverse iterator to the beginning
-    reverse_iterator rbegin() noexcept
+    /// access specified element with bounds checking
+    const T& at(const Key& key) const
     {
-        return m_map.rbegin();
+        const auto slot = m_shape->find(key);
+        if (slot == shape_type::npos)
+        {
+            throw std::out_of_range("key not found");
+        }
+        return m_values[slot];
     }
 
-    /// returns a reverse iterator to the end
-    reverse_iterator rend() noexcept
+    /// access specified element, appending it if needed
+    T& operator[](const Key& key)
     {
-        return m_map.rend();
+        const auto slot = m_shape->find(key);
+        if (slot != shape_type::npos)
+        {
+            return m_values[slot];
+        }
+
+        auto shape = shape_type::add(m_shape, key);
+        m_values.emplace_back();
+        m_shape = std::move(shape);
+        return m_values.back();
     }
 
-    /// returns a reverse iterator to the beginning
-    const_reverse_iterator rbegin() const noexcept
+
+    /*
+     * Iterators
+     */
+
+    iterator begin() noexcept
     {
-        return m_map.rbegin();
+        return iterator(this, 0);
     }
 
-    /// returns a reverse iterator to the end
-    const_reverse_iterator rend() const noexcept
+    iterator end() noexcept
     {
-        return m_map.rend();
+        return iterator(this, m_values.size());
     }
 
-    /// returns a reverse iterator to the beginning
-    const_reverse_iterator crbegin() const noexcept
+    const_iterator begin() const noexcept
     {
-        return m_map.crbegin();
+        return const_iterator(this, 0);
     }
 
-    /// returns a reverse iterator to the end
-    const_reverse_iterator crend() const noexcept
+    const_iterator end() const noexcept
     {
-        return m_map.crend();
+        return const_iterator(this, m_values.size());
     }
 
 
@@ -278,22 +3346,14 @@ template <
      * Capacity
      */
 
-    /// checks whether the container is empty
     bool empty() const noexcept
     {
-        return m_map.empty();
+        return m_values.empty();
     }
 
-    /// returns the number of elements
     size_type size() const noexcept
     {
-        return m_map.size();
-    }
-
-    /// returns the maximum possible number of elements
-    size_type max_size() const noexcept
-    {
-        return m_map.max_size();
+        return m_values.size();
     }
 
 
@@ -304,233 +3364,400 @@ template <
     /// clears the contents
     void clear() noexcept
     {
-        m_map.clear();
-        m_keys.clear();
-    }
-
-    /// insert value
-    std::pair<iterator, bool> insert(const value_type& value)
-    {
-        m_compare.add_key(value.first);
-        return m_map.insert(value);
-    }
-
-    /// insert value
-    template<class P>
-    std::pair<iterator, bool> insert( P&& value )
-    {
-        m_compare.add_key(value.first);
-        return m_map.insert(value);
+        m_shape = m_root;
+        m_values.clear();
     }
 
-    /// insert value with hint
-    iterator insert(const_iterator hint, const value_type& value)
+    /// appends @a value under @a key unless the key exists
+    template<class V>
+    std::pair<iterator, bool> insert(const Key& key, V&& value)
     {
-        m_compare.add_key(value.first);
-        return m_map.insert(hint, value);
-    }
+        const auto slot = m_shape->find(key);
+        if (slot != shape_type::npos)
+        {
+            return {iterator(this, slot), false};
+        }
 
-    /// insert value with hint
-    iterator insert(const_iterator hint, value_type&& value)
-    {
-        m_compare.add_key(value.first);
-        return m_map.insert(hint, value);
+        auto shape = shape_type::add(m_shape, key);
+        m_values.emplace_back(std::forward<V>(value));
+        m_shape = std::move(shape);
+        return {iterator(this, m_values.size() - 1), true};
     }
 
-    /// insert value range
-    template<class InputIt>
-    void insert(InputIt first, InputIt last)
+    /// remove elements with key
+    size_type erase(const Key& key)
     {
-        for (const_iterator it = first; it != last; ++it)
+        const auto slot = m_shape->find(key);
+        if (slot == shape_type::npos)
         {
-            m_compare.add_key(it->first);
+            return 0;
         }
 
-        m_map.insert(first, last);
-    }
-
-    /// insert value list
-    void insert(std::initializer_list<value_type> ilist)
-    {
-        for (auto value : ilist)
+        // replay the remaining keys from the root
+        shape_pointer shape = m_root;
+        for (std::size_t i = 0; i < m_values.size(); ++i)
         {
-            m_compare.add_key(value.first);
+            if (i != slot)
+            {
+                shape = shape_type::add(shape, m_shape->key(i));
+            }
         }
 
-        m_map.insert(ilist);
+        m_values.erase(m_values.begin() + static_cast<std::ptrdiff_t>(slot));
+        m_shape = std::move(shape);
+        return 1;
     }
 
-    /// constructs element in-place
-    template<class... Args>
-    std::pair<iterator, bool> emplace(Args&& ... args)
+
+    /*
+     * Lookup
+     */
+
+    /// returns the number of elements matching specific key
+    size_type count(const Key& key) const
     {
-        typename fifo_map::value_type value(std::forward<Args>(args)...);
-        m_compare.add_key(value.first);
-        return m_map.emplace(std::move(value));
+        return m_shape->find(key) == shape_type::npos ? 0 : 1;
     }
 
-    /// constructs element in-place with hint
-    template<class... Args>
-    iterator emplace_hint(const_iterator hint, Args&& ... args)
+    /// finds element with specific key
+    iterator find(const Key& key)
     {
-        typename fifo_map::value_type value(std::forward<Args>(args)...);
-        m_compare.add_key(value.first);
-        return m_map.emplace_hint(hint, std::move(value));
+        const auto slot = m_shape->find(key);
+        return slot == shape_type::npos ? end() : iterator(this, slot);
     }
 
-    /// remove element at position
-    iterator erase(const_iterator pos)
+    /// finds element with specific key
+    const_iterator find(const Key& key) const
     {
-        m_compare.remove_key(pos->first);
-        return m_map.erase(pos);
+        const auto slot = m_shape->find(key);
+        return slot == shape_type::npos ? end() : const_iterator(this, slot);
     }
 
-    /// remove elements in range
-    iterator erase(const_iterator first, const_iterator last)
+    /// returns the shape describing the keys
+    const shape_pointer& shape() const noexcept
     {
-        for (const_iterator it = first; it != last; ++it)
-        {
-            m_compare.remove_key(it->first);
-        }
-
-        return m_map.erase(first, last);
+        return m_shape;
     }
 
-    /// remove elements with key
-    size_type erase(const key_type& key)
-    {
-        size_type res = m_map.erase(key);
+  private:
+    /// the empty shape all key sequences start from
+    shape_pointer m_root;
+    /// the shape describing the current keys
+    shape_pointer m_shape;
+    /// the values, one per slot of the shape
+    std::vector<T> m_values;
+};
 
-        if (res > 0)
-        {
-            m_compare.remove_key(key);
-        }
+/*!
+@brief cache with the S3-FIFO eviction policy
 
-        return res;
-    }
+Entries enter a small probationary FIFO queue holding about 10% of the
+capacity. Entries hit more than once while there move to the main queue once
+they reach its front; the others are evicted and their keys are remembered in
+a ghost queue. A key found in the ghost queue is inserted directly into the
+main queue. Entries leaving the main queue get another round for each of up to
+three hits. Hits only increment a counter and never reorder a queue.
 
-    /// swaps the contents
-    void swap(fifo_map& other)
+All three queues are fifo_map objects, so eviction uses their pop_front() and
+move_to_back() operations.
+*/
+template<class Key, class T>
+class s3fifo_cache
+{
+  public:
+    using key_type = Key;
+    using mapped_type = T;
+    using size_type = std::size_t;
+
+    /// constructor given the maximal number of entries (at least 1)
+    explicit s3fifo_cache(size_type capacity)
+        : m_capacity((std::max)(capacity, static_cast<size_type>(1))),
+          m_small_capacity((std::max)(m_capacity / 10, static_cast<size_type>(1))),
+          m_small(), m_main(), m_ghost()
     {
-        std::swap(m_map, other.m_map);
-        std::swap(m_compare, other.m_compare);
-        std::swap(m_keys, other.m_keys);
+        m_ghost.set_capacity((std::max)(m_capacity - m_small_capacity, static_cast<size_type>(1)));
     }
 
-
-    /*
-     * Lookup
-     */
-
-    /// returns the number of elements matching specific key
-    size_type count(const Key& key) const
+    /// returns the maximal number of entries
+    size_type capacity() const noexcept
     {
-        return m_map.count(key);
+        return m_capacity;
     }
 
-    /// finds element with specific key
-    iterator find(const Key& key)
+    /// returns the number of entries
+    size_type size() const noexcept
     {
-        return m_map.find(key);
+        return m_small.size() + m_main.size();
     }
 
-    /// finds element with specific key
-    const_iterator find(const Key& key) const
+    /// checks whether the cache is empty
+    bool empty() const noexcept
     {
-        return m_map.find(key);
+        return size() == 0;
     }
 
-    /// returns range of elements matching a specific key
-    std::pair<iterator, iterator> equal_range(const Key& key)
+    /// checks whether a key is cached without counting a hit
+    bool contains(const Key& key) const
     {
-        return m_map.equal_range(key);
+        return m_small.count(key) != 0 || m_main.count(key) != 0;
     }
 
-    /// returns range of elements matching a specific key
-    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const
+    /*!
+    @brief returns a pointer to the cached value or nullptr; counts a hit
+
+    The pointer is valid only until the next call to insert() or erase():
+    eviction moves entries between queues, and with it their values.
+    */
+    T* find(const Key& key)
     {
-        return m_map.equal_range(key);
+        auto it = m_small.find(key);
+        if (it == m_small.end())
+        {
+            it = m_main.find(key);
+            if (it == m_main.end())
+            {
+                count_lookup(false);
+                return nullptr;
+            }
+        }
+
+        count_lookup(true);
+        if (it->second.frequency < max_frequency)
+        {
+            ++it->second.frequency;
+        }
+        return &it->second.value;
     }
 
-    /// returns an iterator to the first element not less than the given key
-    iterator lower_bound(const Key& key)
+    /// caches @a value under @a key, replacing a cached value
+    template<class V>
+    void insert(const Key& key, V&& value)
     {
-        return m_map.lower_bound(key);
+        auto it = m_small.find(key);
+        if (it != m_small.end() || (it = m_main.find(key)) != m_main.end())
+        {
+            it->second.value = std::forward<V>(value);
+            if (m_record_stats)
+            {
+                fifo_map_stats_counters::increment(m_stats.overwrites);
+            }
+            return;
+        }
+
+        while (size() >= m_capacity)
+        {
+            evict();
+        }
+
+        if (m_ghost.erase(key) != 0)
+        {
+            m_main.emplace(key, entry(std::forward<V>(value)));
+        }
+        else
+        {
+            m_small.emplace(key, entry(std::forward<V>(value)));
+        }
+
+        if (m_record_stats)
+        {
+            fifo_map_stats_counters::increment(m_stats.inserts);
+        }
     }
 
-    /// returns an iterator to the first element not less than the given key
-    const_iterator lower_bound(const Key& key) const
+    /// removes a key; returns whether it was cached
+    bool erase(const Key& key)
     {
-        return m_map.lower_bound(key);
+        return m_small.erase(key) != 0 || m_main.erase(key) != 0;
     }
 
-    /// returns an iterator to the first element greater than the given key
-    iterator upper_bound(const Key& key)
+    /// removes all entries and forgets the ghost keys
+    void clear()
     {
-        return m_map.upper_bound(key);
+        m_small.clear();
+        m_main.clear();
+        m_ghost.clear();
     }
 
-    /// returns an iterator to the first element greater than the given key
-    const_iterator upper_bound(const Key& key) const
+    /// returns whether operation counters are collected
+    bool stats_enabled() const noexcept
     {
-        return m_map.upper_bound(key);
+        return m_record_stats;
     }
 
+    /*!
+    @brief starts or stops collecting operation counters
 
-    /*
-     * Observers
-     */
+    Lookups are calls to find(), evictions count entries dropped from either
+    queue, and insertions of cached keys count as overwrites. Promotions to
+    the main queue are not counted.
+    */
+    void enable_stats(bool enabled = true) noexcept
+    {
+        m_record_stats = enabled;
+    }
 
-    /// returns the function that compares keys
-    key_compare key_comp() const
+    /// returns a snapshot of the operation counters
+    fifo_map_stats stats() const noexcept
     {
-        return m_compare;
+        return m_stats.snapshot();
     }
 
+    /// resets all operation counters to 0
+    void reset_stats() noexcept
+    {
+        m_stats.reset();
+    }
 
-    /*
-     * Non-member functions
-     */
+  private:
+    /// the maximal value of the hit counter
+    static constexpr std::uint8_t max_frequency = 3;
 
-    friend bool operator==(const fifo_map& lhs, const fifo_map& rhs)
+    /// a cached value with its hit counter
+    struct entry
     {
-        return lhs.m_map == rhs.m_map;
-    }
+        template<class V>
+        explicit entry(V&& v) : value(std::forward<V>(v)), frequency(0) {}
 
-    friend bool operator!=(const fifo_map& lhs, const fifo_map& rhs)
+        T value;
+        std::uint8_t frequency;
+    };
+
+    /// evicts one entry from the queue that is over its share
+    void evict()
     {
-        return lhs.m_map != rhs.m_map;
+        if (m_small.size() >= m_small_capacity || m_main.empty())
+        {
+            evict_small();
+        }
+        else
+        {
+            evict_main();
+        }
     }
 
-    friend bool operator<(const fifo_map& lhs, const fifo_map& rhs)
+    /// promotes entries hit more than once, evicts the first other one
+    void evict_small()
     {
-        return lhs.m_map < rhs.m_map;
+        while (!m_small.empty())
+        {
+            auto& front = m_small.front();
+            if (front.second.frequency > 1)
+            {
+                m_main.emplace(front.first, entry(std::move(front.second.value)));
+                m_small.pop_front();
+            }
+            else
+            {
+                m_ghost.emplace(front.first, true);
+                m_small.pop_front();
+                count_eviction();
+                return;
+            }
+        }
     }
 
-    friend bool operator<=(const fifo_map& lhs, const fifo_map& rhs)
+    /// gives hit entries another round, evicts the first other one
+    void evict_main()
     {
-        return lhs.m_map <= rhs.m_map;
+        while (!m_main.empty())
+        {
+            auto& front = m_main.front();
+            if (front.second.frequency > 0)
+            {
+                --front.second.frequency;
+                m_main.move_to_back(m_main.begin());
+            }
+            else
+            {
+                m_main.pop_front();
+                count_eviction();
+                return;
+            }
+        }
     }
 
-    friend bool operator>(const fifo_map& lhs, const fifo_map& rhs)
+    /// counts a lookup if collection is enabled
+    void count_lookup(bool hit) noexcept
     {
-        return lhs.m_map > rhs.m_map;
+        if (m_record_stats)
+        {
+            fifo_map_stats_counters::increment(m_stats.lookups);
+            fifo_map_stats_counters::increment(hit ? m_stats.hits : m_stats.misses);
+        }
     }
 
-    friend bool operator>=(const fifo_map& lhs, const fifo_map& rhs)
+    /// counts an eviction if collection is enabled
+    void count_eviction() noexcept
     {
-        return lhs.m_map >= rhs.m_map;
+        if (m_record_stats)
+        {
+            fifo_map_stats_counters::increment(m_stats.evictions);
+        }
     }
 
-  private:
-    /// the keys
-    std::unordered_map<Key, std::size_t> m_keys;
-    /// the comparison object
-    Compare m_compare;
-    /// the internal data structure
-    internal_map_type m_map;
+    /// the maximal number of entries
+    size_type m_capacity;
+    /// the target size of the small queue
+    size_type m_small_capacity;
+    /// the probationary queue
+    fifo_map<Key, entry> m_small;
+    /// the main queue
+    fifo_map<Key, entry> m_main;
+    /// the keys recently evicted from the small queue
+    fifo_map<Key, bool> m_ghost;
+    /// whether operation counters are collected
+    bool m_record_stats = false;
+    /// the operation counters
+    fifo_map_stats_counters m_stats {};
 };
 
+template<class Key, class T>
+constexpr std::uint8_t s3fifo_cache<Key, T>::max_frequency;
+
+/*!
+@brief fifo_map whose nodes and key index are allocated from a bump arena
+
+All allocations of the map (tree nodes, key index nodes and buckets) come from
+one arena. Erasing elements does not return memory; destroying the map frees
+all blocks at once. Heap memory owned by the keys and values themselves (e.g.,
+the characters of a long std::string) is not covered.
+*/
+template<class Key, class T>
+using arena_fifo_map = fifo_map<Key, T,
+      fifo_map_compare<Key, fifo_map_arena_allocator<std::pair<const Key, std::size_t>>>,
+      fifo_map_arena_allocator<std::pair<const Key, T>>>;
+
+/*!
+@brief fifo_map recycling erased nodes for later insertions
+
+Tree nodes and key index nodes released by erase() are kept in a
+fifo_map_node_pool and reused by subsequent insertions. Call shrink_to_fit()
+to return the kept nodes to the system.
+*/
+template<class Key, class T>
+using pooled_fifo_map = fifo_map<Key, T,
+      fifo_map_compare<Key, fifo_map_pool_allocator<std::pair<const Key, std::size_t>>>,
+      fifo_map_pool_allocator<std::pair<const Key, T>>>;
+
+/*!
+@brief fifo_map counting the allocations of its tree and key index
+
+The counters are reachable via `get_allocator().counters()`.
+*/
+template<class Key, class T>
+using counting_fifo_map = fifo_map<Key, T,
+      fifo_map_compare<Key, fifo_map_counting_allocator<std::pair<const Key, std::size_t>>>,
+      fifo_map_counting_allocator<std::pair<const Key, T>>>;
+
+/*!
+@brief fifo_map with interned string keys
+
+Keys are handles into a fifo_map_key_pool. Maps holding the same keys share
+their characters, and the key index uses the precomputed hash values.
+*/
+template<class T>
+using interned_fifo_map = fifo_map<fifo_map_interned_key, T>;
+
 }
 
 // specialization of std::swap
@@ -542,6 +3769,16 @@ inline void swap(nlohmann::fifo_map<Key, T, Compare, Allocator>& m1,
 {
     m1.swap(m2);
 }
+
+// specialization of std::hash using the precomputed hash value
+template<>
+struct hash<nlohmann::fifo_map_interned_key>
+{
+    std::size_t operator()(const nlohmann::fifo_map_interned_key& key) const noexcept
+    {
+        return key.hash();
+    }
+};
 }
 
 #endif
@@ -16,8 +16,13 @@
 #include "fifo_map.hpp"
 using nlohmann::fifo_map;
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <list>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 /// helper function to check order of keys
 const auto collect_keys = [](const fifo_map<std::string, int>& m)
@@ -281,6 +286,41 @@ TEST_CASE("modifiers")
         CHECK(m_filled.m_keys.empty());
     }
 
+    SECTION("clear retains buckets")
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            m_empty[std::to_string(i)] = i;
+        }
+        const auto buckets = m_empty.m_keys.bucket_count();
+
+        m_empty.clear();
+        CHECK(m_empty.empty());
+        CHECK(m_empty.m_keys.bucket_count() == buckets);
+
+        m_empty["A"] = 1;
+        m_empty["B"] = 2;
+        CHECK(collect_keys(m_empty) == "AB");
+    }
+
+    SECTION("clear_and_release")
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            m_empty[std::to_string(i)] = i;
+        }
+        const auto buckets = m_empty.m_keys.bucket_count();
+
+        m_empty.clear_and_release();
+        CHECK(m_empty.empty());
+        CHECK(m_empty.m_keys.empty());
+        CHECK(m_empty.m_keys.bucket_count() < buckets);
+
+        m_empty["B"] = 1;
+        m_empty["A"] = 2;
+        CHECK(collect_keys(m_empty) == "BA");
+    }
+
     SECTION("insert")
     {
         SECTION("insert value_type (lvalue)")
@@ -510,6 +550,107 @@ TEST_CASE("modifiers")
         }
     }
 
+    SECTION("erase_keys")
+    {
+        fifo_map<std::string, int> m = {{"A", 1}, {"B", 2}, {"C", 3}, {"D", 4}, {"E", 5}};
+
+        SECTION("few keys")
+        {
+            const std::vector<std::string> keys = {"D", "Z", "D"};
+            CHECK(m.erase_keys(keys.begin(), keys.end()) == 1);
+            CHECK(collect_keys(m) == "ABCE");
+            CHECK(m.m_keys.size() == 4);
+        }
+
+        SECTION("many keys")
+        {
+            const std::vector<std::string> keys = {"E", "A", "C", "X", "A"};
+            CHECK(m.erase_keys(keys.begin(), keys.end()) == 3);
+            CHECK(collect_keys(m) == "BD");
+            CHECK(m.m_keys.size() == 2);
+            CHECK(m.find("B") != m.end());
+            CHECK(m.find("A") == m.end());
+        }
+
+        SECTION("large map")
+        {
+            fifo_map<int, int> large;
+            for (int i = 0; i < 10000; ++i)
+            {
+                large[i] = i;
+            }
+
+            std::vector<int> few = {5, 17, 9999, 20000};
+            CHECK(large.erase_keys(few.begin(), few.end()) == 3);
+
+            std::vector<int> many;
+            for (int i = 0; i < 10000; i += 2)
+            {
+                many.push_back(i);
+            }
+            CHECK(large.erase_keys(many.begin(), many.end()) == 5000);
+
+            CHECK(large.size() == 4997);
+            CHECK(large.m_keys.size() == 4997);
+            CHECK(large.begin()->first == 1);
+            CHECK(large.count(17) == 0);
+            CHECK(large.count(19) == 1);
+
+            large[0] = 0;
+            CHECK(large.rbegin()->first == 0);
+        }
+    }
+
+    SECTION("erase_if")
+    {
+        fifo_map<std::string, int> m = {{"A", 1}, {"B", 2}, {"C", 3}, {"D", 4}, {"E", 5}};
+
+        SECTION("member function")
+        {
+            const auto even = [](const fifo_map<std::string, int>::value_type & x)
+            {
+                return x.second % 2 == 0;
+            };
+            CHECK(m.erase_if(even) == 2);
+            CHECK(collect_keys(m) == "ACE");
+            CHECK(m.m_keys.size() == 3);
+            CHECK(m.find("B") == m.end());
+        }
+
+        SECTION("non-member function")
+        {
+            const auto not_c = [](const fifo_map<std::string, int>::value_type & x)
+            {
+                return x.first != "C";
+            };
+            CHECK(erase_if(m, not_c) == 4);
+            CHECK(collect_keys(m) == "C");
+            CHECK(m.m_keys.size() == 1);
+
+            m["A"] = 1;
+            CHECK(collect_keys(m) == "CA");
+        }
+
+        SECTION("large map")
+        {
+            fifo_map<int, int> large;
+            for (int i = 0; i < 10000; ++i)
+            {
+                large[i] = i;
+            }
+            const auto expired = [](const fifo_map<int, int>::value_type & x)
+            {
+                return x.first % 5 < 2;
+            };
+            CHECK(large.erase_if(expired) == 4000);
+            CHECK(large.size() == 6000);
+            CHECK(large.m_keys.size() == 6000);
+            CHECK(large.begin()->first == 2);
+            CHECK(large.count(5) == 0);
+            CHECK(large.count(7) == 1);
+        }
+    }
+
     SECTION("swap")
     {
         // precondition
@@ -531,6 +672,35 @@ TEST_CASE("modifiers")
         CHECK(!m_filled.empty());
     }
 
+    SECTION("modifying swapped maps")
+    {
+        fifo_map<int, int> a = {{1, 1}, {2, 2}};
+        fifo_map<int, int> b = {{3, 3}};
+        a.set_capacity(3);
+        a.swap(b);
+
+        a[4] = 4;
+        b[5] = 5;
+        CHECK(a.size() == 2);
+        CHECK(a.m_keys.size() == 2);
+        CHECK(a.begin()->first == 3);
+        CHECK(std::prev(a.end())->first == 4);
+        CHECK(a.count(4) == 1);
+        CHECK(a.count(1) == 0);
+
+        // the capacity moved with the elements
+        CHECK(b.capacity() == 3);
+        b[6] = 6;
+        CHECK(b.size() == 3);
+        CHECK(b.m_keys.size() == 3);
+        CHECK(b.count(1) == 0);
+        CHECK(b.begin()->first == 2);
+        CHECK(std::prev(b.end())->first == 6);
+        CHECK(b.erase(5) == 1);
+        CHECK(b.count(5) == 0);
+        CHECK(a.count(5) == 0);
+    }
+
     SECTION("emplace")
     {
         // check initial state
@@ -820,4 +990,1604 @@ TEST_CASE("constructors")
         CHECK(m["B"] == 2);
 
     }
-}
\ No newline at end of file
+
+    SECTION("range constructor keeps the order of the range")
+    {
+        std::vector<std::pair<std::string, int>> inputs = {{"C", 1}, {"A", 2}, {"C", 3}, {"B", 4}};
+        nlohmann::fifo_map<std::string, int> m(inputs.begin(), inputs.end());
+        CHECK(m.size() == 3);
+        CHECK(m.m_keys.size() == 3);
+        CHECK(collect_keys(m) == "CAB");
+        CHECK(m["C"] == 1);
+    }
+
+    SECTION("insert range from non-map iterators")
+    {
+        std::list<std::pair<std::string, int>> inputs = {{"Z", 1}, {"Y", 2}, {"X", 3}};
+        nlohmann::fifo_map<std::string, int> m = {{"Y", 0}};
+        m.insert(std::make_move_iterator(inputs.begin()), std::make_move_iterator(inputs.end()));
+        CHECK(collect_keys(m) == "YZX");
+        CHECK(m["Y"] == 0);
+        CHECK(m["X"] == 3);
+    }
+
+    SECTION("insert range reserves the key index")
+    {
+        std::vector<std::pair<std::string, int>> inputs;
+        for (int i = 0; i < 1000; ++i)
+        {
+            inputs.emplace_back(std::to_string(i), i);
+        }
+
+        nlohmann::fifo_map<std::string, int> m;
+        m.insert(inputs.begin(), inputs.end());
+        CHECK(m.size() == 1000);
+        CHECK(m.m_keys.bucket_count() * m.m_keys.max_load_factor() >= 1000);
+        CHECK(m.begin()->first == "0");
+        CHECK(m.rbegin()->first == "999");
+
+        m.reserve(5000);
+        CHECK(m.m_keys.bucket_count() * m.m_keys.max_load_factor() >= 5000);
+    }
+}
+
+TEST_CASE("arena")
+{
+    SECTION("map-owned arena")
+    {
+        nlohmann::arena_fifo_map<std::string, int> m;
+        m["C"] = 1;
+        m["A"] = 2;
+        m["B"] = 3;
+        CHECK(m.size() == 3);
+        CHECK(m.m_keys.size() == 3);
+        CHECK(m.get_allocator().arena()->bytes_reserved() > 0);
+
+        m.erase("A");
+        std::string result;
+        for (const auto& x : m)
+        {
+            result += x.first;
+        }
+        CHECK(result == "CB");
+    }
+
+    SECTION("shared arena")
+    {
+        auto arena = std::make_shared<nlohmann::fifo_map_arena>();
+        using amap = nlohmann::arena_fifo_map<int, int>;
+        {
+            amap m1{amap::allocator_type(arena)};
+            amap m2{amap::allocator_type(arena)};
+            for (int i = 0; i < 100; ++i)
+            {
+                m1[i] = i;
+                m2[100 - i] = i;
+            }
+            CHECK(m1.get_allocator() == m2.get_allocator());
+            CHECK(m1.begin()->first == 0);
+            CHECK(m2.begin()->first == 100);
+
+            amap m3 = m1;
+            CHECK(m3 == m1);
+        }
+        CHECK(arena->bytes_reserved() > 0);
+        arena->release();
+        CHECK(arena->bytes_reserved() == 0);
+    }
+
+    SECTION("alignment")
+    {
+        nlohmann::fifo_map_arena arena(16);
+        for (std::size_t alignment : {1u, 2u, 8u, 16u, 64u})
+        {
+            void* p = arena.allocate(3, alignment);
+            CHECK(reinterpret_cast<std::uintptr_t>(p) % alignment == 0);
+        }
+        CHECK(arena.allocate(1000, 8) != nullptr);
+    }
+}
+
+TEST_CASE("node pool")
+{
+    SECTION("sliding window runs without allocations")
+    {
+        nlohmann::pooled_fifo_map<int, int> m;
+        const auto pool = m.get_allocator().pool();
+
+        for (int i = 0; i < 100; ++i)
+        {
+            m[i] = i;
+        }
+
+        std::size_t allocations = 0;
+        for (int i = 100; i < 10000; ++i)
+        {
+            m.erase(m.begin());
+            m[i] = i;
+
+            if (i == 200)
+            {
+                allocations = pool->upstream_allocations();
+            }
+        }
+
+        CHECK(m.size() == 100);
+        CHECK(m.begin()->first == 9900);
+        CHECK(pool->upstream_allocations() == allocations);
+    }
+
+    SECTION("retention limit")
+    {
+        auto pool = std::make_shared<nlohmann::fifo_map_node_pool>(10);
+        using pmap = nlohmann::pooled_fifo_map<int, int>;
+        pmap m{pmap::allocator_type(pool)};
+        CHECK(pool->retention() == 10);
+
+        for (int i = 0; i < 100; ++i)
+        {
+            m[i] = i;
+        }
+        m.erase(m.begin(), m.end());
+
+        // at most 10 of the 200 released nodes are kept per size
+        CHECK(pool->retained() > 0);
+        CHECK(pool->retained() < 50);
+
+        m.shrink_to_fit();
+        CHECK(pool->retained() == 0);
+    }
+
+    SECTION("shrink_to_fit without pool")
+    {
+        fifo_map<std::string, int> m = {{"A", 1}};
+        m.shrink_to_fit();
+        CHECK(m.size() == 1);
+    }
+}
+
+TEST_CASE("allocation counting")
+{
+    nlohmann::counting_fifo_map<int, int> m;
+    const auto counters = m.get_allocator().counters();
+
+    SECTION("insert and erase")
+    {
+        m[1] = 1;
+        const auto before = *counters;
+
+        // one tree node and one key index node
+        m[2] = 2;
+        auto delta = *counters - before;
+        CHECK(delta.allocations >= 2);
+        CHECK(delta.bytes_allocated > 0);
+        CHECK(delta.deallocations == 0);
+
+        const auto before_erase = *counters;
+        m.erase(2);
+        delta = *counters - before_erase;
+        CHECK(delta.allocations == 0);
+        CHECK(delta.deallocations == 2);
+    }
+
+    SECTION("lookup does not allocate")
+    {
+        m[1] = 1;
+        const auto before = *counters;
+        CHECK(m.find(1) != m.end());
+        CHECK(m.find(2) == m.end());
+        CHECK(m.count(1) == 1);
+        CHECK(m.at(1) == 1);
+        CHECK(m[1] == 1);
+        CHECK(m.insert({1, 2}).second == false);
+        const auto delta = *counters - before;
+        CHECK(delta.allocations == 0);
+        CHECK(delta.deallocations == 0);
+    }
+
+    SECTION("all memory is returned")
+    {
+        {
+            nlohmann::counting_fifo_map<int, int> m2{m.get_allocator()};
+            for (int i = 0; i < 100; ++i)
+            {
+                m2[i] = i;
+            }
+        }
+        CHECK(counters->allocations == counters->deallocations);
+        CHECK(counters->bytes_allocated == counters->bytes_deallocated);
+    }
+
+    SECTION("default comparator keeps std::allocator for the key index")
+    {
+        using alloc = nlohmann::fifo_map_counting_allocator<std::pair<const int, int>>;
+        fifo_map<int, int, nlohmann::fifo_map_compare<int>, alloc> m2;
+        const auto before = *m2.get_allocator().counters();
+        m2[1] = 1;
+        m2[2] = 2;
+        CHECK(m2.begin()->first == 1);
+
+        // only the tree nodes are counted
+        const auto delta = *m2.get_allocator().counters() - before;
+        CHECK(delta.allocations == 2);
+    }
+}
+
+TEST_CASE("interned keys")
+{
+    nlohmann::fifo_map_key_pool pool;
+    nlohmann::interned_fifo_map<int> m1;
+    nlohmann::interned_fifo_map<int> m2;
+
+    m1[pool.intern("C")] = 1;
+    m1[pool.intern("A")] = 2;
+    m2[pool.intern(std::string("A"))] = 3;
+    m2[pool.intern("B")] = 4;
+
+    SECTION("strings are stored once")
+    {
+        CHECK(pool.size() == 3);
+        CHECK(&m1.find(pool.intern("A"))->first.str() == &m2.begin()->first.str());
+    }
+
+    SECTION("order and lookup")
+    {
+        std::string result;
+        for (const auto& x : m1)
+        {
+            result += x.first;
+        }
+        CHECK(result == "CA");
+
+        CHECK(m1.at(*pool.find("A")) == 2);
+        CHECK(m2.count(*pool.find("C")) == 0);
+        CHECK(m2.erase(*pool.find("A")) == 1);
+        CHECK(m2.begin()->first.str() == "B");
+    }
+
+    SECTION("lookups do not grow the pool")
+    {
+        CHECK(pool.find("Z") == nullptr);
+        CHECK(pool.size() == 3);
+
+        const auto* a = pool.find("A");
+        REQUIRE(a != nullptr);
+        CHECK(*a == pool.intern("A"));
+        CHECK(&a->str() == &m1.find(*a)->first.str());
+        CHECK(pool.size() == 3);
+    }
+
+    SECTION("handles")
+    {
+        const auto a = pool.intern("A");
+        const auto b = pool.intern("B");
+        CHECK(a == pool.intern("A"));
+        CHECK(a != b);
+        CHECK(a < b);
+        CHECK(std::hash<nlohmann::fifo_map_interned_key>()(a) == std::hash<std::string>()("A"));
+
+        nlohmann::fifo_map_key_pool other;
+        CHECK(a == other.intern("A"));
+    }
+}
+
+TEST_CASE("shaped maps")
+{
+    using smap = nlohmann::shaped_fifo_map<std::string, int>;
+    auto root = smap::shape_type::make_root();
+
+    smap m1(root);
+    m1["id"] = 1;
+    m1["name"] = 2;
+    m1["age"] = 3;
+
+    smap m2(root);
+    m2.insert("id", 4);
+    m2.insert("name", 5);
+    m2.insert("age", 6);
+
+    SECTION("identical key sequences share a shape")
+    {
+        CHECK(m1.shape() == m2.shape());
+        CHECK(m1.shape()->size() == 3);
+
+        smap m3(root);
+        m3["name"] = 1;
+        m3["id"] = 2;
+        CHECK(m3.shape() != m1.shape());
+    }
+
+    SECTION("element access")
+    {
+        CHECK(m1.at("name") == 2);
+        CHECK(m2.at("age") == 6);
+        CHECK_THROWS_AS(m1.at("Z"), std::out_of_range&);
+        CHECK(m1.count("id") == 1);
+        CHECK(m1.count("Z") == 0);
+        CHECK(m1.find("Z") == m1.end());
+        CHECK(m1.find("age").value() == 3);
+
+        const smap& mc = m2;
+        CHECK(mc.at("id") == 4);
+        CHECK(mc.find("name").key() == "name");
+
+        CHECK(m2.insert("id", 10).second == false);
+        CHECK(m2["id"] == 4);
+    }
+
+    SECTION("iteration order")
+    {
+        std::string result;
+        int sum = 0;
+        for (auto x : m1)
+        {
+            result += x.first;
+            sum += x.second;
+        }
+        CHECK(result == "idnameage");
+        CHECK(sum == 6);
+    }
+
+    SECTION("standard algorithms")
+    {
+        CHECK(std::distance(m1.begin(), m1.end()) == 3);
+
+        const auto it = std::find_if(m1.begin(), m1.end(), [](smap::const_iterator::reference x)
+        {
+            return x.second == 2;
+        });
+        REQUIRE(it != m1.end());
+        CHECK(it->first == "name");
+
+        auto jt = m2.begin();
+        jt->second = 7;
+        CHECK(m2.at("id") == 7);
+
+        smap::iterator unset;
+        unset = m2.begin();
+        CHECK(unset == m2.begin());
+    }
+
+    SECTION("erase and clear")
+    {
+        CHECK(m1.erase("Z") == 0);
+        CHECK(m1.erase("name") == 1);
+        CHECK(m1.size() == 2);
+        CHECK(m1.at("age") == 3);
+
+        m2.erase("name");
+        CHECK(m1.shape() == m2.shape());
+
+        m1.clear();
+        CHECK(m1.empty());
+        CHECK(m1.shape() == root);
+    }
+
+    SECTION("growing maps share one index")
+    {
+        smap big(root);
+        for (int i = 0; i < 1000; ++i)
+        {
+            big[std::to_string(i)] = i;
+        }
+        CHECK(big.at("999") == 999);
+
+        const auto& shape = *big.shape();
+        CHECK(shape.m_index == shape.m_parent->m_index);
+        CHECK(shape.m_index->keys.size() == 1000);
+        CHECK(shape.m_parent->find("999") == smap::shape_type::npos);
+        CHECK(shape.m_parent->find("998") == 998);
+
+        // a second child of the same parent gets its own index
+        smap other(root);
+        other["id"] = 1;
+        other["x"] = 2;
+        CHECK(other.at("x") == 2);
+        CHECK(other.find("name") == other.end());
+        CHECK(other.shape()->m_index != m1.shape()->m_index);
+        CHECK(m1.at("age") == 3);
+    }
+
+    SECTION("default-constructed maps have their own root")
+    {
+        std::weak_ptr<smap::shape_type> shape;
+        {
+            smap a = {{"x", 1}, {"y", 2}};
+            smap b;
+            b["x"] = 3;
+            b["y"] = 4;
+            CHECK(a.shape() != b.shape());
+            shape = a.shape();
+        }
+        CHECK(shape.expired());
+
+        smap c(root, {{"id", 7}, {"name", 8}, {"age", 9}});
+        CHECK(c.shape() == m1.shape());
+    }
+}
+
+TEST_CASE("adopt")
+{
+    std::vector<std::pair<std::string, int>> entries = {{"C", 1}, {"A", 2}, {"C", 3}, {"B", 4}};
+
+    SECTION("first_wins")
+    {
+        fifo_map<std::string, int> m;
+        m.adopt(std::move(entries));
+        CHECK(entries.empty());
+        CHECK(collect_keys(m) == "CAB");
+        CHECK(m["C"] == 1);
+        CHECK(m.m_keys.size() == 3);
+    }
+
+    SECTION("last_wins")
+    {
+        fifo_map<std::string, int> m;
+        m.adopt(std::move(entries), nlohmann::fifo_map_duplicate_policy::last_wins);
+        CHECK(collect_keys(m) == "CAB");
+        CHECK(m["C"] == 3);
+    }
+
+    SECTION("last_wins_moves_to_end")
+    {
+        fifo_map<std::string, int> m = {{"B", 0}, {"Z", 0}};
+        m.adopt(std::move(entries), nlohmann::fifo_map_duplicate_policy::last_wins_moves_to_end);
+        CHECK(collect_keys(m) == "ZACB");
+        CHECK(m["C"] == 3);
+        CHECK(m["B"] == 4);
+        CHECK(m.m_keys.size() == 4);
+        CHECK(m.find("A") != m.end());
+    }
+
+    SECTION("values are moved")
+    {
+        std::vector<std::pair<std::string, std::unique_ptr<int>>> values;
+        values.emplace_back("X", std::unique_ptr<int>(new int(42)));
+        fifo_map<std::string, std::unique_ptr<int>> m;
+        m.adopt(std::move(values));
+        CHECK(*m.at("X") == 42);
+    }
+}
+
+TEST_CASE("release")
+{
+    SECTION("entries in insertion order")
+    {
+        fifo_map<std::string, int> m = {{"C", 1}, {"A", 2}, {"B", 3}};
+        auto entries = m.release();
+        CHECK(m.empty());
+        CHECK(m.m_keys.empty());
+        REQUIRE(entries.size() == 3);
+        CHECK(entries[0] == std::make_pair(std::string("C"), 1));
+        CHECK(entries[1] == std::make_pair(std::string("A"), 2));
+        CHECK(entries[2] == std::make_pair(std::string("B"), 3));
+
+        // round trip
+        m.adopt(std::move(entries));
+        CHECK(collect_keys(m) == "CAB");
+    }
+
+    SECTION("values are moved")
+    {
+        fifo_map<std::string, std::unique_ptr<int>> m;
+        m["X"].reset(new int(42));
+        auto entries = m.release();
+        REQUIRE(entries.size() == 1);
+        CHECK(*entries[0].second == 42);
+    }
+}
+
+TEST_CASE("insert_range")
+{
+    fifo_map<std::string, int> m = {{"A", 1}, {"B", 2}, {"C", 3}};
+    const std::vector<std::pair<std::string, int>> patch = {{"B", 20}, {"D", 40}, {"A", 10}, {"D", 41}};
+
+    SECTION("first_wins")
+    {
+        CHECK(m.insert_range(patch.begin(), patch.end(), nlohmann::fifo_map_duplicate_policy::first_wins) == 1);
+        CHECK(collect_keys(m) == "ABCD");
+        CHECK(m["A"] == 1);
+        CHECK(m["B"] == 2);
+        CHECK(m["D"] == 40);
+    }
+
+    SECTION("last_wins")
+    {
+        CHECK(m.insert_range(patch.begin(), patch.end(), nlohmann::fifo_map_duplicate_policy::last_wins) == 1);
+        CHECK(collect_keys(m) == "ABCD");
+        CHECK(m["A"] == 10);
+        CHECK(m["B"] == 20);
+        CHECK(m["D"] == 41);
+    }
+
+    SECTION("last_wins_moves_to_end")
+    {
+        CHECK(m.insert_range(patch.begin(), patch.end(), nlohmann::fifo_map_duplicate_policy::last_wins_moves_to_end) == 1);
+        CHECK(collect_keys(m) == "CBAD");
+        CHECK(m["A"] == 10);
+        CHECK(m["B"] == 20);
+        CHECK(m["D"] == 41);
+        CHECK(m.m_keys.size() == 4);
+    }
+
+    SECTION("move iterators")
+    {
+        std::vector<std::pair<std::string, std::unique_ptr<int>>> values;
+        values.emplace_back("X", std::unique_ptr<int>(new int(1)));
+        values.emplace_back("X", std::unique_ptr<int>(new int(2)));
+        fifo_map<std::string, std::unique_ptr<int>> pm;
+        pm.insert_range(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()),
+                        nlohmann::fifo_map_duplicate_policy::last_wins);
+        CHECK(pm.size() == 1);
+        CHECK(*pm.at("X") == 2);
+    }
+}
+
+TEST_CASE("bounded capacity")
+{
+    fifo_map<std::string, int> m;
+    CHECK(m.capacity() == 0);
+    m.set_capacity(3);
+    CHECK(m.capacity() == 3);
+
+    SECTION("inserting evicts the oldest element")
+    {
+        m["A"] = 1;
+        m.insert({"B", 2});
+        m.emplace("C", 3);
+        CHECK(collect_keys(m) == "ABC");
+
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "BCD");
+        CHECK(m.m_keys.size() == 3);
+
+        // existing keys do not evict
+        m["B"] = 5;
+        m.insert({"C", 6});
+        CHECK(collect_keys(m) == "BCD");
+
+        const std::vector<std::pair<std::string, int>> values = {{"E", 7}, {"F", 8}};
+        m.insert(values.begin(), values.end());
+        CHECK(collect_keys(m) == "DEF");
+        CHECK(m.m_keys.size() == 3);
+    }
+
+    SECTION("shrinking evicts immediately")
+    {
+        m = {{"A", 1}, {"B", 2}, {"C", 3}};
+        m.set_capacity(1);
+        CHECK(collect_keys(m) == "C");
+        m.set_capacity(0);
+        m["D"] = 4;
+        m["E"] = 5;
+        CHECK(collect_keys(m) == "CDE");
+    }
+
+    SECTION("copies keep the capacity")
+    {
+        fifo_map<std::string, int> copy = m;
+        CHECK(copy.capacity() == 3);
+
+        fifo_map<std::string, int> assigned;
+        assigned = m;
+        CHECK(assigned.capacity() == 3);
+    }
+}
+
+TEST_CASE("copy assignment")
+{
+    fifo_map<std::string, int> m1 = {{"C", 1}, {"A", 2}};
+    fifo_map<std::string, int> m2 = {{"X", 3}};
+
+    m2 = m1;
+    CHECK(m2 == m1);
+
+    // the copy must use its own key index
+    m2["B"] = 4;
+    m1["Z"] = 5;
+    CHECK(collect_keys(m2) == "CAB");
+    CHECK(collect_keys(m1) == "CAZ");
+    CHECK(m2.m_keys.size() == 3);
+    CHECK(m1.m_keys.size() == 3);
+    CHECK(m2.find("B") != m2.end());
+    CHECK(m2.find("Z") == m2.end());
+}
+
+TEST_CASE("front and back")
+{
+    fifo_map<std::string, int> m = {{"C", 1}, {"A", 2}, {"B", 3}};
+    const fifo_map<std::string, int>& mc = m;
+
+    SECTION("access")
+    {
+        CHECK(m.front().first == "C");
+        CHECK(m.back().first == "B");
+        CHECK(mc.front().second == 1);
+        CHECK(mc.back().second == 3);
+
+        m.front().second = 10;
+        CHECK(m["C"] == 10);
+    }
+
+    SECTION("pop_front")
+    {
+        m.pop_front();
+        CHECK(collect_keys(m) == "AB");
+        CHECK(m.m_keys.size() == 2);
+        m.pop_front();
+        m.pop_front();
+        CHECK(m.empty());
+        CHECK(m.m_keys.empty());
+    }
+
+    SECTION("pop_back")
+    {
+        m.pop_back();
+        CHECK(collect_keys(m) == "CA");
+        CHECK(m.m_keys.size() == 2);
+        CHECK(m.count("B") == 0);
+
+        m["B"] = 4;
+        CHECK(m.back().first == "B");
+    }
+
+    SECTION("queue")
+    {
+        fifo_map<int, int> q;
+        for (int i = 0; i < 100; ++i)
+        {
+            q[i] = i;
+            if (i % 2 == 1)
+            {
+                q.pop_front();
+            }
+        }
+        CHECK(q.size() == 50);
+        CHECK(q.front().first == 50);
+        CHECK(q.back().first == 99);
+    }
+}
+
+TEST_CASE("move to back")
+{
+    fifo_map<std::string, int> m = {{"A", 1}, {"B", 2}, {"C", 3}};
+
+    SECTION("touch")
+    {
+        CHECK(m.touch("A"));
+        CHECK(collect_keys(m) == "BCA");
+        CHECK(m.touch("C"));
+        CHECK(collect_keys(m) == "BAC");
+        CHECK(m.touch("C"));
+        CHECK(collect_keys(m) == "BAC");
+        CHECK(! m.touch("Z"));
+        CHECK(m.size() == 3);
+        CHECK(m.m_keys.size() == 3);
+        CHECK(m["A"] == 1);
+        CHECK(m.find("B")->second == 2);
+    }
+
+    SECTION("move_to_back")
+    {
+        auto it = m.move_to_back(m.find("B"));
+        CHECK(it->first == "B");
+        CHECK(it->second == 2);
+        CHECK(collect_keys(m) == "ACB");
+
+        it = m.move_to_back(m.begin());
+        CHECK(it == --m.end());
+        CHECK(collect_keys(m) == "CBA");
+    }
+
+    SECTION("LRU")
+    {
+        fifo_map<int, std::string> lru;
+        lru.set_capacity(3);
+        lru[1] = "one";
+        lru[2] = "two";
+        lru[3] = "three";
+        lru.touch(1);
+        lru[4] = "four";
+        CHECK(lru.count(2) == 0);
+        CHECK(lru.front().first == 3);
+        CHECK(lru.at(1) == "one");
+    }
+}
+
+TEST_CASE("eviction callback")
+{
+    fifo_map<std::string, std::unique_ptr<int>> m;
+    std::vector<std::pair<std::string, int>> evicted;
+    m.set_eviction_callback([&evicted](const std::string & key, std::unique_ptr<int>&& value)
+    {
+        std::unique_ptr<int> owned = std::move(value);
+        evicted.emplace_back(key, *owned);
+    });
+    m.set_capacity(2);
+
+    m["A"].reset(new int(1));
+    m["B"].reset(new int(2));
+    CHECK(evicted.empty());
+
+    SECTION("capacity eviction")
+    {
+        m["C"].reset(new int(3));
+        REQUIRE(evicted.size() == 1);
+        CHECK(evicted[0] == std::make_pair(std::string("A"), 1));
+    }
+
+    SECTION("pop_front and pop_back")
+    {
+        m.pop_back();
+        m.pop_front();
+        REQUIRE(evicted.size() == 2);
+        CHECK(evicted[0] == std::make_pair(std::string("B"), 2));
+        CHECK(evicted[1] == std::make_pair(std::string("A"), 1));
+        CHECK(m.empty());
+    }
+
+    SECTION("erase is not reported")
+    {
+        m.erase("A");
+        m.clear();
+        CHECK(evicted.empty());
+    }
+
+    SECTION("removing the callback")
+    {
+        m.set_eviction_callback(nullptr);
+        m["C"].reset(new int(3));
+        CHECK(evicted.empty());
+        CHECK(m.size() == 2);
+    }
+}
+
+TEST_CASE("clock eviction")
+{
+    fifo_map<std::string, int> m;
+    CHECK(m.eviction_policy() == nlohmann::fifo_map_eviction_policy::fifo);
+    m.set_eviction_policy(nlohmann::fifo_map_eviction_policy::clock);
+    CHECK(m.eviction_policy() == nlohmann::fifo_map_eviction_policy::clock);
+    m.set_capacity(3);
+
+    m["A"] = 1;
+    m["B"] = 2;
+    m["C"] = 3;
+
+    SECTION("unreferenced elements are evicted in order")
+    {
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "BCD");
+    }
+
+    SECTION("referenced elements get a second chance")
+    {
+        CHECK(m.find("A")->second == 1);
+        CHECK(m.at("B") == 2);
+        CHECK(collect_keys(m) == "ABC");
+
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "ABD");
+        CHECK(m.m_keys.size() == 3);
+
+        // D counts as behind the hand, which wraps around; the second chance
+        // cleared the reference bits
+        m["E"] = 5;
+        CHECK(collect_keys(m) == "BDE");
+        m["F"] = 6;
+        CHECK(collect_keys(m) == "DEF");
+    }
+
+    SECTION("operator[] on an existing key is a hit")
+    {
+        m["A"] = 10;
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "ACD");
+        CHECK(m["A"] == 10);
+    }
+
+    SECTION("hits leave the timestamps alone")
+    {
+        const auto timestamp = m.m_keys.at("A");
+        m.find("A");
+        CHECK(m.m_keys.at("A") == timestamp);
+        CHECK(m.m_cache->elements.at(timestamp).referenced);
+
+        // copies keep the bit
+        const auto copy = m;
+        CHECK(copy.m_cache->elements.at(timestamp).referenced);
+        CHECK_FALSE(copy.m_cache->elements.at(copy.m_keys.at("B")).referenced);
+    }
+
+    SECTION("all elements referenced")
+    {
+        m.find("A");
+        m.find("B");
+        m.find("C");
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "BCD");
+        CHECK(m.at("D") == 4);
+    }
+
+    SECTION("const lookups count, pop_front does not")
+    {
+        const auto& cm = m;
+        CHECK(cm.find("A")->second == 1);
+        CHECK(cm.at("A") == 1);
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "ACD");
+
+        m.find("C");
+        m.pop_front();
+        CHECK(collect_keys(m) == "CD");
+    }
+
+    SECTION("second chances keep references valid")
+    {
+        fifo_map<int, std::string> n;
+        n.set_eviction_policy(nlohmann::fifo_map_eviction_policy::clock);
+        n.set_capacity(2);
+        n[1] = "one";
+        n[2] = "two";
+        std::string& one = n[1];
+        n[3] = "three";
+        CHECK(n.count(1) == 1);
+        CHECK(n.count(2) == 0);
+        CHECK(&n.at(1) == &one);
+        CHECK(one == "one");
+    }
+
+    SECTION("missing keys")
+    {
+        CHECK(m.find("X") == m.end());
+        CHECK_THROWS_AS(m.at("X"), std::out_of_range&);
+    }
+
+    SECTION("fifo policy ignores hits")
+    {
+        m.set_eviction_policy(nlohmann::fifo_map_eviction_policy::fifo);
+        m.find("A");
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "BCD");
+    }
+}
+
+TEST_CASE("weight budget")
+{
+    fifo_map<std::string, int> m;
+    const auto weigher = [](const std::string&, const int& value)
+    {
+        return static_cast<std::size_t>(value);
+    };
+
+    m["A"] = 1;
+    m.set_weigher(weigher);
+    CHECK(m.total_weight() == 1);
+    CHECK(m.max_weight() == 0);
+    m.set_max_weight(10);
+    CHECK(m.max_weight() == 10);
+
+    m.insert({"B", 3});
+    m.insert({"C", 5});
+    CHECK(m.total_weight() == 9);
+    CHECK(collect_keys(m) == "ABC");
+
+    SECTION("insertions evict the oldest elements")
+    {
+        m.insert({"D", 2});
+        CHECK(collect_keys(m) == "BCD");
+        CHECK(m.total_weight() == 10);
+    }
+
+    SECTION("removals are tracked")
+    {
+        m.erase("B");
+        CHECK(m.total_weight() == 6);
+        m.erase(m.begin());
+        CHECK(m.total_weight() == 5);
+        m.pop_back();
+        CHECK(m.total_weight() == 0);
+
+        m.insert({"X", 1});
+        m.insert({"Y", 1});
+        const std::vector<std::string> keys = {"X"};
+        m.erase_keys(keys.begin(), keys.end());
+        CHECK(m.total_weight() == 1);
+        m.erase_if([](const std::pair<const std::string, int>&)
+        {
+            return true;
+        });
+        CHECK(m.total_weight() == 0);
+    }
+
+    SECTION("insert_or_assign measures again")
+    {
+        CHECK(!m.insert_or_assign("C", 4).second);
+        CHECK(m.total_weight() == 8);
+        CHECK(collect_keys(m) == "ABC");
+
+        // the assigned element is kept
+        CHECK(!m.insert_or_assign("B", 9).second);
+        CHECK(collect_keys(m) == "B");
+        CHECK(m.total_weight() == 9);
+
+        CHECK(m.insert_or_assign(std::string("D"), 1).second);
+        CHECK(collect_keys(m) == "BD");
+        CHECK(m.total_weight() == 10);
+    }
+
+    SECTION("heavy elements stay until the next insertion")
+    {
+        m.insert({"D", 20});
+        CHECK(collect_keys(m) == "D");
+        CHECK(m.total_weight() == 20);
+
+        m.insert({"E", 0});
+        CHECK(collect_keys(m) == "E");
+        CHECK(m.total_weight() == 0);
+    }
+
+    SECTION("lowering the budget")
+    {
+        m.set_max_weight(5);
+        CHECK(collect_keys(m) == "C");
+        m.set_max_weight(0);
+        m.insert({"D", 20});
+        CHECK(m.size() == 2);
+    }
+
+    SECTION("duplicate policies")
+    {
+        const std::vector<std::pair<std::string, int>> entries = {{"A", 7}};
+        m.insert_range(entries.begin(), entries.end(), nlohmann::fifo_map_duplicate_policy::last_wins);
+        CHECK(collect_keys(m) == "A");
+        CHECK(m.total_weight() == 7);
+    }
+
+    SECTION("operator[] measures the default value")
+    {
+        m.clear();
+        CHECK(m.total_weight() == 0);
+        m["A"] = 20;
+        CHECK(m.total_weight() == 0);
+
+        // removal subtracts the stored weight, not the current one
+        m.insert_or_assign("B", 5);
+        m.find("B")->second = 7;
+        CHECK(m.total_weight() == 5);
+        m.erase("A");
+        CHECK(m.total_weight() == 5);
+        m.pop_front();
+        CHECK(m.total_weight() == 0);
+
+        m["A"] = 20;
+        m.set_weigher(nullptr);
+        CHECK(m.total_weight() == 0);
+        m.insert({"B", 20});
+        CHECK(m.size() == 2);
+    }
+}
+
+TEST_CASE("statistics")
+{
+    fifo_map<std::string, int> m;
+    m["A"] = 1;
+    CHECK(!m.stats_enabled());
+    CHECK(m.stats().lookups == 0);
+
+    m.enable_stats();
+    CHECK(m.stats_enabled());
+    m.set_capacity(2);
+
+    m.find("A");
+    m.find("X");
+    const auto& cm = m;
+    cm.at("A");
+    m["B"] = 2;
+    m["A"] = 3;
+    m.insert({"C", 3});
+    m.insert({"C", 4});
+    m.insert_or_assign("C", 5);
+
+    auto stats = m.stats();
+    CHECK(stats.lookups == 5);
+    CHECK(stats.hits == 3);
+    CHECK(stats.misses == 2);
+    CHECK(stats.hit_ratio() == Approx(0.6));
+    CHECK(stats.inserts == 2);
+    CHECK(stats.overwrites == 1);
+    CHECK(stats.evictions == 1);
+    CHECK(stats.expirations == 0);
+
+    SECTION("expirations")
+    {
+        fifo_map<std::string, int>::time_point now;
+        m.set_clock([&now]()
+        {
+            return now;
+        });
+        m.set_ttl(std::chrono::seconds(1));
+        m["D"] = 4;
+        now += std::chrono::seconds(1);
+        m.expire();
+        CHECK(m.stats().expirations == 2);
+        CHECK(m.stats().evictions == 2);
+    }
+
+    SECTION("pausing and resetting")
+    {
+        m.enable_stats(false);
+        m.find("A");
+        CHECK(m.stats().lookups == 5);
+
+        m.reset_stats();
+        CHECK(m.stats().lookups == 0);
+        CHECK(m.stats().hit_ratio() == 0.0);
+    }
+}
+
+TEST_CASE("TinyLFU admission")
+{
+    SECTION("frequency sketch")
+    {
+        nlohmann::fifo_map_frequency_sketch empty;
+        CHECK(empty.width() == 0);
+        empty.increment(1);
+        CHECK(empty.estimate(1) == 0);
+
+        nlohmann::fifo_map_frequency_sketch sketch(20);
+        CHECK(sketch.width() == 32);
+        sketch.increment(1);
+        sketch.increment(1);
+        sketch.increment(1);
+        CHECK(sketch.estimate(1) == 3);
+        CHECK(sketch.estimate(2) == 0);
+
+        for (int i = 0; i < 20; ++i)
+        {
+            sketch.increment(2);
+        }
+        CHECK(sketch.estimate(2) == 15);
+
+        // the 320th counting increment halves all counters
+        for (std::size_t i = 0; i < 305; ++i)
+        {
+            sketch.increment(1000 + i);
+        }
+        CHECK(sketch.estimate(2) < 15);
+
+        sketch.clear();
+        CHECK(sketch.estimate(2) == 0);
+    }
+
+    fifo_map<std::string, int> m;
+    CHECK(m.admission_policy() == nlohmann::fifo_map_admission_policy::always);
+    m.set_capacity(3);
+    m.set_admission_policy(nlohmann::fifo_map_admission_policy::tinylfu);
+    CHECK(m.admission_policy() == nlohmann::fifo_map_admission_policy::tinylfu);
+    m.enable_stats();
+
+    m.insert({"A", 1});
+    m.insert({"B", 2});
+    m.insert({"C", 3});
+    m.find("A");
+
+    SECTION("new keys must be used more often than the victim")
+    {
+        const auto rejected = m.insert({"X", 4});
+        CHECK(!rejected.second);
+        CHECK(rejected.first == m.end());
+        CHECK(m.m_keys.size() == 3);
+        CHECK(!m.emplace("X", 4).second);
+        CHECK(m.stats().rejections == 2);
+
+        CHECK(m.insert({"X", 4}).second);
+        CHECK(collect_keys(m) == "BCX");
+    }
+
+    SECTION("lookups count")
+    {
+        m.find("X");
+        m.find("X");
+        CHECK(m.insert({"X", 4}).second);
+        CHECK(collect_keys(m) == "BCX");
+    }
+
+    SECTION("const lookups are not written to the sketch")
+    {
+        const auto& cm = m;
+        cm.find("X");
+        cm.find("X");
+        CHECK(m.stats().lookups == 3);
+        CHECK(!m.insert({"X", 4}).second);
+    }
+
+    SECTION("operator[] always inserts")
+    {
+        m["Y"] = 5;
+        CHECK(collect_keys(m) == "BCY");
+    }
+
+    SECTION("other insertions")
+    {
+        CHECK(m.insert_or_assign("Z", 6).first == m.end());
+        CHECK(m.m_keys.size() == 3);
+
+        const std::vector<std::pair<std::string, int>> entries = {{"Z", 6}, {"Z", 7}};
+        CHECK(m.insert_range(entries.begin(), entries.end(), nlohmann::fifo_map_duplicate_policy::last_wins) == 1);
+        CHECK(collect_keys(m) == "BCZ");
+        CHECK(m["Z"] == 7);
+    }
+
+    SECTION("disabling admission")
+    {
+        m.set_admission_policy(nlohmann::fifo_map_admission_policy::always);
+        CHECK(m.insert({"X", 4}).second);
+        CHECK(collect_keys(m) == "BCX");
+    }
+}
+
+TEST_CASE("deferred reclaim")
+{
+    fifo_map<std::string, std::shared_ptr<int>> m;
+    CHECK(!m.deferred_reclaim());
+    m.set_deferred_reclaim(true);
+    CHECK(m.deferred_reclaim());
+    m.set_capacity(1);
+
+    m["A"] = std::make_shared<int>(1);
+    std::weak_ptr<int> a = m["A"];
+    m["B"] = std::make_shared<int>(2);
+    std::weak_ptr<int> b = m["B"];
+    m["C"] = std::make_shared<int>(3);
+
+    CHECK(m.size() == 1);
+    CHECK(m.front().first == "C");
+    CHECK(m.pending_reclaim() == 2);
+    CHECK(!a.expired());
+    CHECK(!b.expired());
+
+    SECTION("reclaim with budget")
+    {
+        CHECK(m.reclaim(1) == 1);
+        CHECK(m.pending_reclaim() == 1);
+        CHECK(m.reclaim() == 1);
+        CHECK(a.expired());
+        CHECK(b.expired());
+        CHECK(m.reclaim() == 0);
+    }
+
+    SECTION("taking the list")
+    {
+        auto pending = m.take_reclaim_list();
+        CHECK(pending.size() == 2);
+        CHECK(m.pending_reclaim() == 0);
+        pending.clear();
+        CHECK(a.expired());
+    }
+
+    SECTION("erase destroys immediately")
+    {
+        std::weak_ptr<int> c = m["C"];
+        m.erase("C");
+        CHECK(c.expired());
+        CHECK(m.pending_reclaim() == 2);
+    }
+
+    SECTION("the eviction callback takes precedence")
+    {
+        std::size_t evicted = 0;
+        m.set_eviction_callback([&evicted](const std::string&, std::shared_ptr<int>&&)
+        {
+            ++evicted;
+        });
+        m["D"] = std::make_shared<int>(4);
+        CHECK(evicted == 1);
+        CHECK(m.pending_reclaim() == 2);
+    }
+
+    SECTION("disabling destroys pending values")
+    {
+        m.set_deferred_reclaim(false);
+        CHECK(m.pending_reclaim() == 0);
+        CHECK(a.expired());
+    }
+}
+
+TEST_CASE("memory usage")
+{
+    nlohmann::counting_fifo_map<std::string, int> m;
+    CHECK(m.memory_usage().total() == 0);
+
+    const auto counters = m.get_allocator().counters();
+    for (int i = 0; i < 1000; ++i)
+    {
+        m[std::to_string(i)] = i;
+    }
+
+    // without a cache mode, the key index holds nothing but timestamps
+    CHECK(sizeof(decltype(m.m_keys)::mapped_type) == sizeof(std::size_t));
+
+    const auto usage = m.memory_usage();
+    CHECK(usage.entries == 1000 * sizeof(std::pair<const std::string, int>));
+    CHECK(usage.order >= 1000 * 3 * sizeof(void*));
+    CHECK(usage.key_index >= 1000 * sizeof(std::pair<const std::string, std::size_t>));
+    CHECK(usage.buckets >= 1000 * sizeof(void*));
+    CHECK(usage.cache == 0);
+
+    // the estimate covers all live allocations plus the heap overhead; the
+    // node layouts of other libraries are only approximated
+    const auto live = counters->bytes_allocated - counters->bytes_deallocated;
+#if defined(__GLIBCXX__)
+    CHECK(usage.total() >= live);
+    CHECK(usage.total() <= live * 3 / 2);
+#else
+    CHECK(usage.total() >= live / 2);
+    CHECK(usage.total() <= live * 2);
+#endif
+
+    SECTION("clear keeps the buckets as slack")
+    {
+        m.clear();
+        const auto cleared = m.memory_usage();
+        CHECK(cleared.entries == 0);
+        CHECK(cleared.key_index == 0);
+        CHECK(cleared.slack >= usage.buckets);
+    }
+
+    SECTION("cache state")
+    {
+        m.set_admission_policy(nlohmann::fifo_map_admission_policy::tinylfu);
+        m.set_capacity(1000);
+        const auto cached = m.memory_usage();
+        CHECK(cached.cache >= 4096);
+    }
+}
+
+TEST_CASE("shrink_to_fit and trim")
+{
+    fifo_map<int, int> m;
+    for (int i = 0; i < 10000; ++i)
+    {
+        m[i] = i;
+    }
+    m.erase(std::next(m.begin(), 10), m.end());
+    const auto peak_buckets = m.m_keys.bucket_count();
+    CHECK(peak_buckets >= 10000);
+
+    SECTION("key index")
+    {
+        m.trim(0.5f);
+        CHECK(m.m_keys.bucket_count() >= 20);
+        CHECK(m.m_keys.bucket_count() < 100);
+        const auto trimmed = m.m_keys.bucket_count();
+
+        // a lower target load does not grow the key index
+        m.trim(0.25f);
+        CHECK(m.m_keys.bucket_count() == trimmed);
+
+        m.shrink_to_fit();
+        CHECK(m.m_keys.bucket_count() >= 10);
+        CHECK(m.m_keys.bucket_count() < trimmed);
+
+        CHECK(m.size() == 10);
+        CHECK(m.begin()->first == 0);
+        CHECK(std::prev(m.end())->first == 9);
+        CHECK(m.find(5)->second == 5);
+    }
+
+    SECTION("invalid target loads shrink fully")
+    {
+        m.trim(0.0f);
+        CHECK(m.m_keys.bucket_count() < 100);
+    }
+
+    SECTION("cache state")
+    {
+        fifo_map<int, int>::time_point now;
+        m.set_clock([&now]()
+        {
+            return now;
+        });
+        m.set_ttl(std::chrono::seconds(1));
+        for (int i = 10; i < 1000; ++i)
+        {
+            m[i] = i;
+        }
+        now += std::chrono::seconds(1);
+        m.expire();
+        CHECK(m.empty());
+
+        m.set_ttl(fifo_map<int, int>::duration::zero());
+        m.set_deferred_reclaim(true);
+        m.set_capacity(1);
+        for (int i = 0; i < 1000; ++i)
+        {
+            m[i] = i;
+        }
+        m.reclaim();
+        CHECK(m.m_cache->reclaim_list.capacity() >= 999);
+
+        m.trim(0.5f);
+        CHECK(m.m_cache->reclaim_list.capacity() == 0);
+        CHECK(m.size() == 1);
+    }
+}
+
+TEST_CASE("expiry")
+{
+    using fmap = fifo_map<std::string, int>;
+    fmap::time_point now;
+    fmap m = {{"A", 1}};
+    m.set_clock([&now]()
+    {
+        return now;
+    });
+    CHECK(m.ttl() == fmap::duration::zero());
+    m.set_ttl(std::chrono::seconds(10));
+    CHECK(m.ttl() == std::chrono::seconds(10));
+
+    now += std::chrono::seconds(5);
+    m["B"] = 2;
+    m["C"] = 3;
+
+    SECTION("explicit expire")
+    {
+        CHECK(m.expire() == 0);
+        now += std::chrono::seconds(5);
+        CHECK(m.expire() == 1);
+        CHECK(collect_keys(m) == "BC");
+        CHECK(m.m_keys.size() == 2);
+
+        CHECK(m.expire(now + std::chrono::seconds(5)) == 2);
+        CHECK(m.empty());
+    }
+
+    SECTION("insertions sweep incrementally")
+    {
+        now += std::chrono::seconds(20);
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "CD");
+        m["E"] = 5;
+        CHECK(collect_keys(m) == "DE");
+    }
+
+    SECTION("erased and moved elements")
+    {
+        m.erase("A");
+        now += std::chrono::seconds(3);
+        m.touch("B");
+        now += std::chrono::seconds(6);
+        CHECK(m.expire() == 0);
+        CHECK(collect_keys(m) == "CB");
+
+        now += std::chrono::seconds(1);
+        CHECK(m.expire() == 1);
+        CHECK(collect_keys(m) == "B");
+
+        now += std::chrono::seconds(3);
+        CHECK(m.expire() == 1);
+        CHECK(m.empty());
+    }
+
+    SECTION("lookups treat expired elements as missing")
+    {
+        now += std::chrono::seconds(7);
+        const auto& cm = m;
+        CHECK(cm.count("A") == 0);
+        CHECK(cm.find("A") == cm.end());
+        CHECK_THROWS_AS(cm.at("A"), std::out_of_range&);
+        CHECK(cm.count("B") == 1);
+        CHECK(m.size() == 3);
+
+        CHECK(m.find("A") == m.end());
+        CHECK(collect_keys(m) == "BC");
+        CHECK(m.find("B")->second == 2);
+
+        // operator[] replaces an expired element with a new one
+        now += std::chrono::seconds(5);
+        CHECK_THROWS_AS(m.at("C"), std::out_of_range&);
+        m["D"] = 4;
+        CHECK(collect_keys(m) == "D");
+        now += std::chrono::seconds(10);
+        CHECK(m["D"] == 0);
+        CHECK(m.size() == 1);
+        const std::string key = "D";
+        now += std::chrono::seconds(10);
+        CHECK(m[key] == 0);
+        CHECK(m.expire() == 0);
+    }
+
+    SECTION("repeated touches keep one deadline per element")
+    {
+        const auto cache = m.memory_usage().cache;
+        for (int i = 0; i < 1000; ++i)
+        {
+            m.touch("A");
+            m.touch("B");
+        }
+        CHECK(m.memory_usage().cache == cache);
+        CHECK(collect_keys(m) == "CAB");
+
+        now += std::chrono::seconds(10);
+        CHECK(m.expire() == 3);
+    }
+
+    SECTION("expired elements are passed to the callback")
+    {
+        std::string evicted;
+        m.set_eviction_callback([&evicted](const std::string & key, int&&)
+        {
+            evicted += key;
+        });
+        now += std::chrono::seconds(100);
+        m.expire();
+        CHECK(evicted == "ABC");
+    }
+
+    SECTION("expired elements during CLOCK and weight eviction")
+    {
+        fmap n;
+        n.set_clock([&now]()
+        {
+            return now;
+        });
+        n.set_ttl(std::chrono::seconds(10));
+        n.set_eviction_policy(nlohmann::fifo_map_eviction_policy::clock);
+        n.set_weigher([](const std::string&, const int& value)
+        {
+            return static_cast<std::size_t>(value);
+        });
+        n.set_max_weight(50);
+        n.insert({"a", 1});
+        n.insert({"b", 1});
+        n.insert({"c", 1});
+        n.insert({"d", 1});
+        n.insert({"e", 1});
+        n.find("c");
+        now += std::chrono::seconds(20);
+
+        // second chances and evictions must not sweep the assigned element
+        const auto result = n.insert_or_assign("c", 100);
+        CHECK(!result.second);
+        REQUIRE(result.first != n.end());
+        CHECK(result.first->first == "c");
+        CHECK(result.first->second == 100);
+        CHECK(n.size() == 1);
+        CHECK(n.total_weight() == 100);
+
+        // the second chance does not renew the deadline
+        CHECK(n.expire() == 1);
+        CHECK(n.empty());
+        n.insert({"f", 1});
+        CHECK(collect_keys(n) == "f");
+    }
+
+    SECTION("disabling expiry")
+    {
+        CHECK(m.m_cache->elements.size() == 3);
+        m.set_ttl(fmap::duration::zero());
+        CHECK(m.m_cache->elements.empty());
+        now += std::chrono::seconds(100);
+        m["D"] = 4;
+        CHECK(m.expire() == 0);
+        CHECK(m.size() == 4);
+        CHECK(m.m_cache->elements.empty());
+    }
+
+    SECTION("clear")
+    {
+        m.clear();
+        m["X"] = 1;
+        now += std::chrono::seconds(9);
+        CHECK(m.expire() == 0);
+        now += std::chrono::seconds(1);
+        CHECK(m.expire() == 1);
+    }
+}
+
+TEST_CASE("S3-FIFO cache")
+{
+    nlohmann::s3fifo_cache<int, std::string> cache(10);
+    CHECK(cache.capacity() == 10);
+    CHECK(cache.empty());
+
+    SECTION("lookup")
+    {
+        cache.insert(1, "one");
+        REQUIRE(cache.find(1) != nullptr);
+        CHECK(*cache.find(1) == "one");
+        CHECK(cache.find(2) == nullptr);
+        CHECK(cache.contains(1));
+
+        cache.insert(1, "uno");
+        CHECK(*cache.find(1) == "uno");
+        CHECK(cache.size() == 1);
+
+        CHECK(cache.erase(1));
+        CHECK(! cache.erase(1));
+        CHECK(cache.empty());
+    }
+
+    SECTION("size is bounded")
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            cache.insert(i, std::to_string(i));
+            CHECK(cache.size() <= 10);
+        }
+        CHECK(cache.size() == 10);
+    }
+
+    SECTION("statistics")
+    {
+        CHECK(!cache.stats_enabled());
+        cache.enable_stats();
+        CHECK(cache.stats_enabled());
+
+        cache.insert(1, "one");
+        cache.insert(1, "uno");
+        cache.find(1);
+        cache.find(2);
+        for (int i = 100; i < 110; ++i)
+        {
+            cache.insert(i, "x");
+        }
+
+        const auto stats = cache.stats();
+        CHECK(stats.lookups == 2);
+        CHECK(stats.hits == 1);
+        CHECK(stats.misses == 1);
+        CHECK(stats.inserts == 11);
+        CHECK(stats.overwrites == 1);
+        CHECK(stats.evictions == 1);
+
+        cache.reset_stats();
+        CHECK(cache.stats().lookups == 0);
+    }
+
+    SECTION("hot entries survive a scan")
+    {
+        for (int i = 0; i < 5; ++i)
+        {
+            cache.insert(i, "hot");
+            cache.find(i);
+            cache.find(i);
+        }
+
+        for (int i = 100; i < 200; ++i)
+        {
+            cache.insert(i, "scan");
+        }
+
+        for (int i = 0; i < 5; ++i)
+        {
+            CHECK(cache.contains(i));
+        }
+    }
+
+    SECTION("ghost hits go to the main queue")
+    {
+        // 1 is evicted from the small queue without hits
+        cache.insert(1, "one");
+        cache.insert(2, "two");
+        for (int i = 100; i < 110; ++i)
+        {
+            cache.insert(i, "x");
+        }
+        CHECK(! cache.contains(1));
+        CHECK(cache.m_ghost.count(1) == 1);
+
+        cache.insert(1, "one");
+        CHECK(cache.m_main.count(1) == 1);
+        CHECK(cache.m_ghost.count(1) == 0);
+    }
+
+    SECTION("clear")
+    {
+        cache.insert(1, "one");
+        cache.clear();
+        CHECK(cache.empty());
+        CHECK(! cache.contains(1));
+    }
+}